@@ -1,5 +1,15 @@
 #include "Parameters.h"
 #include "boundary_conditions.h"
+#include "sor.h"
+#include "multigrid.h"
+#include "pcg.h"
+#include "visual.h"
+#include "profiler.h"
+#include "reaction.h"
+#include "tc.h"
+#include "uvp.h"
+#include "steady_state.h"
+#include "pressure_predictor.h"
 #include <boost/property_tree/xml_parser.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
@@ -12,6 +22,96 @@ unsigned int Parameters::nof_substances() const
     return substance.size();
 }
 
+
+// FNV-1a over the raw bytes of a value
+template <typename T>
+static void hash_add (uint64_t &h, T const &value)
+{
+    unsigned char const *bytes = reinterpret_cast<unsigned char const *>(&value);
+    for (size_t k = 0; k < sizeof(T); ++k) {
+        h ^= bytes[k];
+        h *= 1099511628211ULL;
+    }
+}
+
+static void hash_add (uint64_t &h, std::string const &value)
+{
+    hash_add(h, value.size());
+    for (size_t k = 0; k < value.size(); ++k) hash_add(h, value[k]);
+}
+
+template <typename T>
+static void hash_add (uint64_t &h, std::vector<T> const &value)
+{
+    hash_add(h, value.size());
+    for (size_t k = 0; k < value.size(); ++k) hash_add(h, value[k]);
+}
+
+// Hash of everything that determines the solution. The end time, step limit,
+// output, checkpoint and steady state settings are left out, so a restarted
+// run may change them. Only what decides the layout of the steady state
+// monitor in the checkpoint is included: whether fields are compared, the
+// number of periods and the probes.
+uint64_t Parameters::hash() const
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    hash_add(h, problem);
+    hash_add(h, Re);  hash_add(h, Pr);  hash_add(h, vol_cp);
+    hash_add(h, UI);  hash_add(h, VI);  hash_add(h, PI);
+    hash_add(h, TI);  hash_add(h, TI_file);  hash_add(h, TI_file_coeff);
+    hash_add(h, beta);  hash_add(h, GX);  hash_add(h, GY);
+    hash_add(h, xlength);  hash_add(h, ylength);  hash_add(h, imax);  hash_add(h, jmax);
+    hash_add(h, dt);  hash_add(h, alpha);  hash_add(h, gamma);  hash_add(h, omg);  hash_add(h, omg_auto);  hash_add(h, omg_max);
+    hash_add(h, sor_ordering);  hash_add(h, residual_mode);  hash_add(h, residual_interval);
+    hash_add(h, solver);  hash_add(h, mg_cycle);  hash_add(h, mg_pre_smooth);
+    hash_add(h, mg_post_smooth);  hash_add(h, mg_levels);  hash_add(h, pcg_preconditioner);
+    hash_add(h, tau);  hash_add(h, itermax);  hash_add(h, eps);  hash_add(h, predictor);
+
+    hash_add(h, wlt);  hash_add(h, wrt);  hash_add(h, wtt);  hash_add(h, wbt);
+    hash_add(h, tl);   hash_add(h, tr);   hash_add(h, tt);   hash_add(h, tb);
+    hash_add(h, T_inf);  hash_add(h, otype);  hash_add(h, oterm);
+    hash_add(h, wlvp);  hash_add(h, wrvp);  hash_add(h, wtvp);  hash_add(h, wbvp);
+    hash_add(h, pl);  hash_add(h, pr);  hash_add(h, pt);  hash_add(h, pb);
+
+    hash_add(h, substance.size());
+    for (size_t s = 0; s < substance.size(); ++s) {
+        hash_add(h, substance[s].name);
+        hash_add(h, substance[s].lambda);
+        hash_add(h, substance[s].H_formation);
+        hash_add(h, substance[s].init_file);
+        hash_add(h, substance[s].init_file_coeff);
+        hash_add(h, substance[s].init_value);
+    }
+
+    hash_add(h, reactions.size());
+    for (size_t r = 0; r < reactions.size(); ++r) {
+        reaction_t const &react = reactions[r];
+        hash_add(h, react.activation_E_back);
+        hash_add(h, react.activation_E_forth);
+        hash_add(h, react.freq_factor_back);
+        hash_add(h, react.freq_factor_forth);
+        hash_add(h, react.reagents);
+        hash_add(h, react.products);
+        hash_add(h, react.st_coeff_reagents);
+        hash_add(h, react.st_coeff_products);
+        hash_add(h, react.exponents_reagents);
+        hash_add(h, react.exponents_products);
+    }
+
+    hash_add(h, diffusion);  hash_add(h, transport_subcycles);
+    hash_add(h, chemistry);  hash_add(h, chem_rtol);  hash_add(h, chem_atol);  hash_add(h, chem_max_substeps);
+
+    hash_add(h, steady_tol > 0);  hash_add(h, steady_periods);
+    hash_add(h, probes.size());
+    for (size_t k = 0; k < probes.size(); ++k) {
+        hash_add(h, probes[k].x);  hash_add(h, probes[k].y);  hash_add(h, probes[k].quantity);
+    }
+
+    hash_add(h, geometry_file);
+    return h;
+}
+
 int Parameters::read_from_file(std::string const &filename, std::string &err_msg)
 {
     // BEWARE
@@ -40,8 +140,23 @@ int Parameters::read_from_file(std::string const &filename, std::string &err_msg
         parse_params_constants (property.get_child ("constants"));
         parse_params_pressure  (property.get_child ("pressure"));
 
-        out_prefix = property.get <std::string> ("output.prefix", "data");
-        out_dt     = property.get <double> ("output.dt_value");
+        parse_params_output    (property.get_child ("output"));
+
+        checkpoint_dt   = 0;
+        checkpoint_file = out_prefix + ".chk";
+        auto checkpoint = property.get_child_optional("checkpoint");
+        if (checkpoint) parse_params_checkpoint (*checkpoint);
+
+        profile_steps = PROFILE_STEPS_NONE;
+        auto profile  = property.get_child_optional("profile");
+        if (profile) parse_params_profile (*profile);
+
+        steady_tol     = 0;
+        steady_dt      = 0;
+        steady_periods = 3;
+        period_tol     = 1e-3;
+        auto steady    = property.get_child_optional("steady");
+        if (steady) parse_params_steady (*steady);
 
 
         UI       = property.get <double> ("velocity.init.u", 0);
@@ -73,6 +188,18 @@ int Parameters::read_from_file(std::string const &filename, std::string &err_msg
 
         root = property.get_child_optional("reactions");
         if (root) parse_params_reactions (*root);
+
+        diffusion           = DIFFUSION_EXPLICIT;
+        transport_subcycles = 1;
+        root = property.get_child_optional("transport");
+        if (root) parse_params_transport (*root);
+
+        chemistry         = CHEMISTRY_EULER;
+        chem_rtol         = 1e-4;
+        chem_atol         = 1e-8;
+        chem_max_substeps = 1000;
+        root = property.get_child_optional("chemistry");
+        if (root) parse_params_chemistry (*root);
     }
     catch (std::runtime_error &err) {
         err_msg = "Failed to extract values from property file: " + std::string(err.what());
@@ -104,6 +231,7 @@ void Parameters::parse_params_time (pt::ptree const &property)
     dt       = property.get <double> ("step");
     t_end    = property.get <double> ("max");
     tau      = property.get <double> ("tau");
+    max_steps = property.get <unsigned int> ("steps", 0);
 }
 
 void Parameters::parse_params_substances (pt::ptree const &property) {
@@ -165,13 +293,87 @@ void Parameters::parse_params_reactions (pt::ptree const &property) {
 }
 
 
+void Parameters::parse_params_transport (pt::ptree const &property)
+{
+    std::string scheme = boost::algorithm::to_lower_copy(property.get <std::string> ("diffusion", "explicit"));
+    if      (scheme == "explicit") diffusion = DIFFUSION_EXPLICIT;
+    else if (scheme == "adi")      diffusion = DIFFUSION_ADI;
+    else throw std::runtime_error("Unknown diffusion scheme " + scheme);
+
+    transport_subcycles = property.get <unsigned int> ("subcycles", 1);
+    if (transport_subcycles == 0) throw std::runtime_error("Transport needs at least one sub-step");
+}
+
+
+void Parameters::parse_params_chemistry (pt::ptree const &property)
+{
+    std::string integrator = boost::algorithm::to_lower_copy(property.get <std::string> ("integrator", "euler"));
+    if      (integrator == "euler")      chemistry = CHEMISTRY_EULER;
+    else if (integrator == "rosenbrock") chemistry = CHEMISTRY_ROSENBROCK;
+    else throw std::runtime_error("Unknown chemistry integrator " + integrator);
+
+    chem_rtol         = property.get <double>       ("rtol", chem_rtol);
+    chem_atol         = property.get <double>       ("atol", chem_atol);
+    chem_max_substeps = property.get <unsigned int> ("max_substeps", chem_max_substeps);
+    if (chem_rtol <= 0 || chem_atol <= 0) throw std::runtime_error("Chemistry tolerances must be positive");
+    if (chem_max_substeps == 0) throw std::runtime_error("Chemistry needs at least one sub-step");
+}
+
 
 void Parameters::parse_params_sor (pt::ptree const &property)
 {
     itermax  = property.get <double> ("itermax");
     eps      = property.get <double> ("eps");
     omg      = property.get <double> ("omega");
+    omg_auto = property.get <bool> ("omega.<xmlattr>.adapt", false);
+    omg_max  = property.get <double> ("omega.<xmlattr>.max", SOR_OMEGA_MAX);
+    if (omg_max <= 1 || omg_max >= 2) throw std::runtime_error("Bound of omega must be between 1 and 2");
     alpha    = property.get <double> ("alpha");
+
+    std::string ordering = boost::algorithm::to_lower_copy(property.get <std::string> ("ordering", "lexicographic"));
+    if      (ordering == "lexicographic") sor_ordering = SOR_LEXICOGRAPHIC;
+    else if (ordering == "red-black")     sor_ordering = SOR_RED_BLACK;
+    else throw std::runtime_error("Unknown SOR ordering " + ordering);
+
+    std::string residual = boost::algorithm::to_lower_copy(property.get <std::string> ("residual.mode", "exact"));
+    if      (residual == "exact") residual_mode = SOR_RESIDUAL_EXACT;
+    else if (residual == "fused") residual_mode = SOR_RESIDUAL_FUSED;
+    else throw std::runtime_error("Unknown residual mode " + residual);
+
+    residual_interval = property.get <unsigned int> ("residual.interval", 1);
+    if (residual_interval == 0) throw std::runtime_error("Residual interval must be at least 1");
+
+    std::string rhs_kernel = boost::algorithm::to_lower_copy(property.get <std::string> ("rhs", "split"));
+    if      (rhs_kernel == "split") rhs = RHS_SPLIT;
+    else if (rhs_kernel == "fused") rhs = RHS_FUSED;
+    else throw std::runtime_error("Unknown right-hand side kernel " + rhs_kernel);
+
+    std::string prediction = boost::algorithm::to_lower_copy(property.get <std::string> ("predictor", "none"));
+    if      (prediction == "none")      predictor = PREDICTOR_NONE;
+    else if (prediction == "linear")    predictor = PREDICTOR_LINEAR;
+    else if (prediction == "quadratic") predictor = PREDICTOR_QUADRATIC;
+    else throw std::runtime_error("Unknown pressure predictor " + prediction);
+
+    std::string solver_name = boost::algorithm::to_lower_copy(property.get <std::string> ("solver", "sor"));
+    if      (solver_name == "sor")       solver = SOLVER_SOR;
+    else if (solver_name == "multigrid") solver = SOLVER_MULTIGRID;
+    else if (solver_name == "pcg")       solver = SOLVER_PCG;
+    else if (solver_name == "fft")       solver = SOLVER_FFT;
+    else throw std::runtime_error("Unknown pressure solver " + solver_name);
+
+    std::string cycle = boost::algorithm::to_lower_copy(property.get <std::string> ("multigrid.cycle", "v"));
+    if      (cycle == "v") mg_cycle = MG_V_CYCLE;
+    else if (cycle == "w") mg_cycle = MG_W_CYCLE;
+    else throw std::runtime_error("Unknown multigrid cycle " + cycle);
+
+    mg_pre_smooth  = property.get <unsigned int> ("multigrid.pre_smooth", 2);
+    mg_post_smooth = property.get <unsigned int> ("multigrid.post_smooth", 2);
+    mg_levels      = property.get <unsigned int> ("multigrid.levels", 0);
+
+    std::string preconditioner = boost::algorithm::to_lower_copy(property.get <std::string> ("pcg.preconditioner", "ic"));
+    if      (preconditioner == "jacobi") pcg_preconditioner = PCG_JACOBI;
+    else if (preconditioner == "ic")     pcg_preconditioner = PCG_INCOMPLETE_CHOLESKY;
+    else throw std::runtime_error("Unknown PCG preconditioner " + preconditioner);
 }
 
 
@@ -197,6 +399,79 @@ void Parameters::parse_params_pressure (pt::ptree const &property)
 }
 
 
+void Parameters::parse_params_output (pt::ptree const &property)
+{
+    out_prefix = property.get <std::string> ("prefix", "data");
+    out_dt     = property.get <double> ("dt_value");
+    out_snapshots = property.get <unsigned int> ("snapshots", 2);
+
+    std::string format = boost::algorithm::to_lower_copy(property.get <std::string> ("format", "ascii"));
+    if      (format == "ascii")  out_format = OUTPUT_VTK_ASCII;
+    else if (format == "binary") out_format = OUTPUT_VTK_BINARY;
+    else if (format == "vti")    out_format = OUTPUT_VTI;
+    else if (format == "vts")    out_format = OUTPUT_VTS;
+    else if (format == "none")   out_format = OUTPUT_NONE;
+    else throw std::runtime_error("Unknown output format " + format);
+
+    std::string encoding = boost::algorithm::to_lower_copy(property.get <std::string> ("encoding", "raw"));
+    if      (encoding == "raw")    out_encoding = OUTPUT_RAW;
+    else if (encoding == "base64") out_encoding = OUTPUT_BASE64;
+    else throw std::runtime_error("Unknown output encoding " + encoding);
+
+    std::string compression = boost::algorithm::to_lower_copy(property.get <std::string> ("compression", "none"));
+    if      (compression == "none") out_compression = OUTPUT_UNCOMPRESSED;
+    else if (compression == "zlib") out_compression = OUTPUT_ZLIB;
+    else throw std::runtime_error("Unknown output compression " + compression);
+}
+
+
+void Parameters::parse_params_checkpoint (pt::ptree const &property)
+{
+    checkpoint_dt   = property.get <double> ("dt_value");
+    checkpoint_file = property.get <std::string> ("file", checkpoint_file);
+}
+
+
+void Parameters::parse_params_profile (pt::ptree const &property)
+{
+    std::string steps = boost::algorithm::to_lower_copy(property.get <std::string> ("steps", "none"));
+    if      (steps == "none") profile_steps = PROFILE_STEPS_NONE;
+    else if (steps == "csv")  profile_steps = PROFILE_STEPS_CSV;
+    else if (steps == "json") profile_steps = PROFILE_STEPS_JSON;
+    else throw std::runtime_error("Unknown profile format " + steps);
+
+    profile_file = property.get <std::string> ("file", out_prefix + ".profile." + steps);
+}
+
+
+void Parameters::parse_params_steady (pt::ptree const &property)
+{
+    steady_tol     = property.get <double> ("tolerance", steady_tol);
+    steady_dt      = property.get <double> ("dt_value", out_dt);
+    steady_periods = property.get <unsigned int> ("periods", steady_periods);
+    period_tol     = property.get <double> ("period_tolerance", period_tol);
+    if (steady_dt <= 0) throw std::runtime_error("Steady state checks need a dt_value > 0");
+    if (steady_periods == 0) throw std::runtime_error("Periodic state needs at least one period");
+
+    for (auto &child : property) {
+        if (child.first.compare("probe")) continue;
+
+        probe_t probe;
+        probe.x = child.second.get <double> ("x");
+        probe.y = child.second.get <double> ("y");
+
+        std::string quantity = boost::algorithm::to_lower_copy(child.second.get <std::string> ("quantity", "u"));
+        if      (quantity == "u") probe.quantity = PROBE_U;
+        else if (quantity == "v") probe.quantity = PROBE_V;
+        else if (quantity == "p") probe.quantity = PROBE_P;
+        else if (quantity == "t") probe.quantity = PROBE_T;
+        else throw std::runtime_error("Unknown probe quantity " + quantity);
+
+        probes.push_back(probe);
+    }
+}
+
+
 void Parameters::get_value_or_file (pt::ptree const &tree, std::string const &what, double &value, std::string &file, double &file_coeff)
 {
     value = tree.get <double> (what, -1);
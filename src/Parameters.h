@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <stdint.h>
 #include <boost/property_tree/ptree.hpp>
 
 
@@ -34,11 +35,18 @@ struct reaction_t {
     std::vector<double> exponents_products;
 };
 
+// A point of the domain sampled every time step, see steady_state.h
+struct probe_t {
+    double x, y;
+    int quantity;
+};
+
 
 class Parameters{
     public:
         int read_from_file(std::string const &filename, std::string &err_msg);
         unsigned int nof_substances() const;
+        uint64_t hash() const;
 
     public:
         std::string problem;
@@ -57,6 +65,7 @@ class Parameters{
         double GX;                /* gravitation x-direction */
         double GY;                /* gravitation y-direction */
         double t_end;             /* end time */
+        unsigned int max_steps;   // stop after this many time steps, 0 = no limit
         double xlength;           /* length of the domain x-dir.*/
         double ylength;           /* length of the domain y-dir.*/
         int imax;                 // Number of cells in x direction
@@ -64,7 +73,22 @@ class Parameters{
         double dt;                /* time step */
         double alpha;             /* uppwind differencing factor*/
         double gamma;             // same as above, temperature
+        int diffusion;            // explicit or ADI diffusion of T and C, see tc.h
+        unsigned int transport_subcycles; // max. steps of T and C per flow step
         double omg;               /* relaxation factor */
+        bool omg_auto;            // adapt omg during the run, see OmegaTuner in sor.h
+        double omg_max;           // upper bound of the adapted omg
+        int sor_ordering;         // lexicographic or red-black sweeps
+        int residual_mode;        // exact or fused residual, see sor.h
+        int rhs;                  // split or fused F, G and RS kernels, see uvp.h
+        unsigned int residual_interval; // SOR iterations between two convergence checks
+        int predictor;            // initial guess of the pressure solver, see pressure_predictor.h
+        int solver;               // pressure solver, see sor.h
+        int mg_cycle;             // 1 for V-cycles, 2 for W-cycles
+        unsigned int mg_pre_smooth;   // smoothing sweeps before and after
+        unsigned int mg_post_smooth;  // the coarse grid correction
+        unsigned int mg_levels;   // maximum number of levels, 0 = no limit
+        int pcg_preconditioner;   // Jacobi or IC(0), see pcg.h
         double tau;               /* safety factor for time step*/
         unsigned int  itermax;    /* max. number of iterations  */
 
@@ -72,6 +96,22 @@ class Parameters{
         double eps;               /* accuracy bound for pressure*/
         std::string out_prefix;
         double out_dt;            /* time for output */
+        int out_format;           // ascii, binary, vti or vts, see visual.h
+        int out_encoding;         // raw or base64, XML formats only
+        int out_compression;      // none or zlib, XML formats only
+        unsigned int out_snapshots; // buffers of the output thread, 0 = write synchronously
+
+        double checkpoint_dt;     // time between two checkpoints, 0 = none
+        std::string checkpoint_file;
+
+        int profile_steps;        // per-step records: none, csv or json, see profiler.h
+        std::string profile_file;
+
+        double steady_tol;        // relative change per unit time, 0 = run until t_end
+        double steady_dt;         // time between two comparisons of the fields
+        unsigned int steady_periods; // periods of the probes that must agree
+        double period_tol;        // relative difference of these periods and peaks
+        std::vector<probe_t> probes;
 
         int wlt;                // Temperature boundary type
         int wrt;
@@ -108,6 +148,11 @@ class Parameters{
 
         std::vector <reaction_t> reactions;
 
+        int chemistry;            // explicit Euler or implicit, see reaction.h
+        double chem_rtol;         // tolerances of the implicit sub-steps
+        double chem_atol;
+        unsigned int chem_max_substeps; // per cell and time step
+
         std::string geometry_file;
 
     private:
@@ -115,9 +160,15 @@ class Parameters{
         void parse_params_time       (pt::ptree const &property);
         void parse_params_substances (pt::ptree const &property);
         void parse_params_reactions  (pt::ptree const &property);
+        void parse_params_chemistry  (pt::ptree const &property);
+        void parse_params_transport  (pt::ptree const &property);
         void parse_params_sor        (pt::ptree const &property);
         void parse_params_constants  (pt::ptree const &property);
         void parse_params_pressure   (pt::ptree const &property);
+        void parse_params_output     (pt::ptree const &property);
+        void parse_params_checkpoint (pt::ptree const &property);
+        void parse_params_profile    (pt::ptree const &property);
+        void parse_params_steady     (pt::ptree const &property);
         void get_value_or_file       (pt::ptree const &tree, std::string const &what, double &value, std::string &file, double &file_coeff);
         int  elem_name_to_idx        (std::string const &name, std::vector<substance_t> const &vec);
 };
@@ -0,0 +1,394 @@
+/**
+ * Micro-benchmarks of the kernels of the time loop on synthetic grids.
+ *
+ * Usage: bench [-n IMAXxJMAX] [-o obstacle fraction] [-s substances]
+ *              [-r repetitions] [-i itermax] [-seed k] [kernel ...]
+ *
+ * The geometry is a box with 4x4 blocks of obstacle cells placed at random
+ * until the requested fraction of the inner cells is covered. Every kernel
+ * runs repetitions times, the fastest run is reported as ns per cell and as
+ * GB/s for the fields it nominally reads and writes. The SOR kernels solve
+ * until convergence, once to warm up and at most 3 times timed, and report
+ * the iterations as well.
+ */
+#include "helper.h"
+#include "Parameters.h"
+#include "field2d.h"
+#include "cell_lists.h"
+#include "init.h"
+#include "uvp.h"
+#include "boundary_val.h"
+#include "boundary_conditions.h"
+#include "sor.h"
+#include "tc.h"
+#include "reaction.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+
+struct bench_config_t {
+    int imax, jmax;
+    double obstacles;
+    unsigned int substances;
+    unsigned int repetitions;
+    unsigned int itermax;
+    unsigned int seed;
+    std::vector<std::string> kernels;
+};
+
+
+// Flag field of a box with random 4x4 obstacle blocks. Blocks aligned to a
+// multiple of 4 never produce forbidden cells.
+static Field2D<int> synthetic_flag (bench_config_t const &config)
+{
+    int imax = config.imax, jmax = config.jmax;
+    std::vector<std::vector<char> > solid(imax + 2, std::vector<char>(jmax + 2, 0));
+
+    // the boundary layer is solid, as for a pgm file
+    for (int i = 0; i <= imax + 1; ++i) solid[i][0] = solid[i][jmax + 1] = 1;
+    for (int j = 0; j <= jmax + 1; ++j) solid[0][j] = solid[imax + 1][j] = 1;
+
+    int bi = imax / 4, bj = jmax / 4;
+    std::vector<int> blocks(bi * bj);
+    for (size_t b = 0; b < blocks.size(); ++b) blocks[b] = b;
+
+    std::mt19937 rng(config.seed);
+    std::shuffle(blocks.begin(), blocks.end(), rng);
+
+    size_t nof_blocks = config.obstacles * blocks.size() + 0.5;
+    for (size_t b = 0; b < nof_blocks && b < blocks.size(); ++b) {
+        int i0 = 1 + 4 * (blocks[b] / bj), j0 = 1 + 4 * (blocks[b] % bj);
+        for (int i = i0; i < i0 + 4; ++i)
+            for (int j = j0; j < j0 + 4; ++j) solid[i][j] = 1;
+    }
+
+    Field2D<int> Flag(imax, jmax);
+    Flag.fill(0);
+    for (int i = 1; i <= imax; ++i) {
+        for (int j = 1; j <= jmax; ++j) {
+            int flag = 0;
+            if (!solid[i][j])   flag += 16;
+            if (!solid[i+1][j]) flag +=  8;
+            if (!solid[i-1][j]) flag +=  4;
+            if (!solid[i][j-1]) flag +=  2;
+            if (!solid[i][j+1]) flag +=  1;
+            if (is_forbidden_cell(flag)) ERROR("Synthetic geometry has a forbidden cell");
+            Flag[i][j] = flag;
+        }
+    }
+    return Flag;
+}
+
+
+// Physical parameters of a closed, heated box with a reversible reaction
+// s0 + s1 <-> s2 (or s0 <-> s1 with two substances)
+static Parameters synthetic_params (bench_config_t const &config)
+{
+    Parameters params = Parameters();
+
+    params.problem  = "bench";
+    params.imax     = config.imax;
+    params.jmax     = config.jmax;
+    params.xlength  = 1;
+    params.ylength  = (double)config.jmax / config.imax;
+    params.dx       = params.xlength / params.imax;
+    params.dy       = params.ylength / params.jmax;
+    params.Re       = 1000;
+    params.Pr       = 7;
+    params.vol_cp   = 1;
+    params.beta     = 2e-4;
+    params.GX       = 0;
+    params.GY       = -9.81;
+    params.alpha    = 0.9;
+    params.gamma    = 0.9;
+    params.omg      = 1.7;
+    params.eps      = 1e-3;
+    params.itermax  = config.itermax;
+    params.tau      = 0.5;
+    params.transport_subcycles = 1;
+    params.T_inf    = 293.15;
+
+    params.wlvp = params.wrvp = params.wtvp = params.wbvp = BC_NO_SLIP;
+    params.wlt  = params.wrt  = BC_NEUMANN;
+    params.wtt  = params.wbt  = BC_DIRICHLET;
+    params.tt   = 0;
+    params.tb   = 1;
+    params.otype = BC_NEUMANN;
+
+    for (unsigned int s = 0; s < config.substances; ++s) {
+        substance_t sub = {};
+        sub.name        = "s" + std::to_string(s);
+        sub.lambda      = 1e-3;
+        sub.H_formation = 1e-3;
+        sub.init_value  = 1;
+        sub.index       = s;
+        params.substance.push_back(sub);
+    }
+
+    if (config.substances >= 2) {
+        reaction_t react = {};
+        react.activation_E_forth = 1000;
+        react.activation_E_back  = 2000;
+        react.freq_factor_forth  = 1;
+        react.freq_factor_back   = 1;
+
+        react.reagents.push_back(0);
+        react.st_coeff_reagents.push_back(1);
+        react.exponents_reagents.push_back(1);
+        if (config.substances >= 3) {
+            react.reagents.push_back(1);
+            react.st_coeff_reagents.push_back(1);
+            react.exponents_reagents.push_back(1);
+        }
+
+        react.products.push_back(config.substances >= 3 ? 2 : 1);
+        react.st_coeff_products.push_back(1);
+        react.exponents_products.push_back(1);
+
+        params.reactions.push_back(react);
+    }
+
+    return params;
+}
+
+
+// Smooth, non-trivial values in all cells including the boundary layer
+static void fill_smooth (Field2D<double> &X, double scale, double phase)
+{
+    for (int i = 0; i <= X.imax() + 1; ++i) {
+        for (int j = 0; j <= X.jmax() + 1; ++j) {
+            double x = (double)i / X.imax(), y = (double)j / X.jmax();
+            X[i][j] = scale * (1.5 + sin(2 * M_PI * x + phase) * cos(2 * M_PI * y));
+        }
+    }
+}
+
+
+struct timing_t {
+    double best;    // seconds
+    double mean;
+};
+
+static timing_t time_kernel (unsigned int repetitions, std::function<void ()> const &kernel)
+{
+    typedef std::chrono::steady_clock clock;
+    timing_t timing = { 1e300, 0 };
+
+    kernel();   // warm up
+    for (unsigned int r = 0; r < repetitions; ++r) {
+        clock::time_point start = clock::now();
+        kernel();
+        double seconds = std::chrono::duration<double>(clock::now() - start).count();
+        timing.best  = std::min(timing.best, seconds);
+        timing.mean += seconds / repetitions;
+    }
+    return timing;
+}
+
+
+static bool selected (bench_config_t const &config, std::string const &kernel)
+{
+    if (config.kernels.empty()) return true;
+    return std::find(config.kernels.begin(), config.kernels.end(), kernel) != config.kernels.end();
+}
+
+
+// cells and doubles are per call, for SOR per iteration
+static void report (char const *kernel, double cells, double doubles, timing_t timing, int iterations = -1)
+{
+    double per_call = iterations > 0 ? iterations : 1;
+    printf("%-22s %10.0f %10.2f %10.2f %8.2f",
+           kernel, cells,
+           1e9 * timing.best / (per_call * cells),
+           1e9 * timing.mean / (per_call * cells),
+           1e-9 * per_call * cells * doubles * sizeof(double) / timing.best);
+    if (iterations >= 0) printf(" %10d", iterations);
+    printf("\n");
+}
+
+
+static void usage (char const *program)
+{
+    printf("Usage: %s [-n IMAXxJMAX] [-o obstacle fraction] [-s substances]\n"
+           "       [-r repetitions] [-i itermax] [-seed k] [kernel ...]\n"
+           "kernels: sor sor_redblack calculate_fg calculate_rs calculate_fg+rs\n"
+           "         calculate_fg_rs calculate_uv calculate calculate_next_C\n"
+           "         calculate_next_scalars reaction_rates reaction_max_dt\n"
+           "         compute_reaction inner_boundary_values\n",
+           program);
+    exit(1);
+}
+
+
+int main (int argc, char **argv)
+{
+    bench_config_t config;
+    config.imax        = 256;
+    config.jmax        = 256;
+    config.obstacles   = 0.1;
+    config.substances  = 3;
+    config.repetitions = 20;
+    config.itermax     = 10000;
+    config.seed        = 1;
+
+    for (int a = 1; a < argc; ++a) {
+        std::string arg(argv[a]);
+        bool has_value = a + 1 < argc;
+
+        if      (arg == "-n" && has_value) {
+            if (sscanf(argv[++a], "%dx%d", &config.imax, &config.jmax) != 2) usage(argv[0]);
+        }
+        else if (arg == "-o" && has_value)    config.obstacles   = atof(argv[++a]);
+        else if (arg == "-s" && has_value)    config.substances  = atoi(argv[++a]);
+        else if (arg == "-r" && has_value)    config.repetitions = atoi(argv[++a]);
+        else if (arg == "-i" && has_value)    config.itermax     = atoi(argv[++a]);
+        else if (arg == "-seed" && has_value) config.seed        = atoi(argv[++a]);
+        else if (arg[0] == '-') usage(argv[0]);
+        else config.kernels.push_back(arg);
+    }
+    if (config.imax < 4 || config.jmax < 4 || config.repetitions == 0) usage(argv[0]);
+
+    Parameters params = synthetic_params(config);
+    Field2D<int> Flag = synthetic_flag(config);
+    CellLists cells;
+    cells.build(Flag);
+
+    int imax = params.imax, jmax = params.jmax;
+    double fluid = cells.nof_fluid;
+    double boundary = 0;
+    for (int o = 1; o < 16; ++o) boundary += cells.boundary[o].size();
+
+    Field2D<double> U(imax, jmax), V(imax, jmax), P(imax, jmax), T(imax, jmax);
+    Field2D<double> F(imax, jmax), G(imax, jmax), RS(imax, jmax), swap(imax, jmax);
+    std::vector<Field2D<double> > C;
+    for (unsigned int s = 0; s < config.substances; ++s) {
+        C.push_back(Field2D<double>(imax, jmax));
+        fill_smooth(C[s], 1, s);
+    }
+    ReactionNetwork network(params);
+    std::vector<Field2D<double> > R;
+    for (unsigned int s = 0; s < config.substances; ++s) R.push_back(Field2D<double>(imax, jmax));
+
+    fill_smooth(U, 0.1, 0);
+    fill_smooth(V, 0.1, 1);
+    fill_smooth(T, 1, 2);
+    fill_smooth(F, 0.1, 3);
+    fill_smooth(G, 0.1, 4);
+    fill_smooth(P, 1, 5);
+    double dt = 1e-4;
+
+    printf("Grid %dx%d, %.0f fluid cells (%.1f%%), %u substances, %u repetitions\n\n",
+           imax, jmax, fluid, 100 * fluid / ((double)imax * jmax), config.substances, config.repetitions);
+    printf("%-22s %10s %10s %10s %8s %10s\n", "kernel", "cells", "ns/cell", "mean", "GB/s", "iterations");
+
+    if (selected(config, "calculate_fg")) {
+        timing_t t = time_kernel(config.repetitions, [&]() { calculate_fg(params, U, V, T, F, G, cells, dt); });
+        report("calculate_fg", fluid, 5, t);
+    }
+
+    if (selected(config, "calculate_rs")) {
+        timing_t t = time_kernel(config.repetitions, [&]() { calculate_rs(dt, params.dx, params.dy, imax, jmax, F, G, RS, cells); });
+        report("calculate_rs", fluid, 3, t);
+    }
+
+    // The split path as the time loop runs it, against the fused kernel
+    if (selected(config, "calculate_fg+rs")) {
+        timing_t t = time_kernel(config.repetitions, [&]() {
+            calculate_fg(params, U, V, T, F, G, cells, dt);
+            calculate_rs(dt, params.dx, params.dy, imax, jmax, F, G, RS, cells);
+        });
+        report("calculate_fg+rs", fluid, 8, t);
+    }
+
+    if (selected(config, "calculate_fg_rs")) {
+        timing_t t = time_kernel(config.repetitions, [&]() { calculate_fg_rs(params, U, V, T, F, G, RS, cells, dt); });
+        report("calculate_fg_rs", fluid, 6, t);
+    }
+
+    if (selected(config, "calculate_uv")) {
+        Field2D<double> U0, V0;
+        U0.assign(U);
+        V0.assign(V);
+        timing_t t = time_kernel(config.repetitions, [&]() { calculate_uv(dt, params.dx, params.dy, imax, jmax, U, V, F, G, P, cells); });
+        report("calculate_uv", fluid, 5, t);
+        U.assign(U0);
+        V.assign(V0);
+    }
+
+    if (selected(config, "calculate")) {
+        timing_t t = time_kernel(config.repetitions, [&]() { calculate_next_T(cells, U, V, T, swap, Flag, params, dt); });
+        report("calculate", fluid, 4, t);
+    }
+
+    if (selected(config, "calculate_next_C")) {
+        timing_t t = time_kernel(config.repetitions, [&]() { calculate_next_C(cells, U, V, C, swap, Flag, params, dt); });
+        report("calculate_next_C", fluid, 4 * config.substances, t);
+    }
+
+    if (selected(config, "calculate_next_scalars")) {
+        std::vector<Field2D<double> > X_new;
+        for (unsigned int s = 0; s <= config.substances; ++s) X_new.push_back(Field2D<double>(imax, jmax));
+        timing_t t = time_kernel(config.repetitions, [&]() { calculate_next_scalars(cells, U, V, &T, C, X_new, Flag, params, dt); });
+        report("calculate_next_scalars", fluid, 4 + 2 * config.substances, t);
+    }
+
+    if (selected(config, "inner_boundary_values")) {
+        timing_t t = time_kernel(config.repetitions, [&]() { inner_boundary_values(imax, jmax, U, V, P, F, G, cells); });
+        report("inner_boundary_values", boundary, 6, t);
+    }
+
+    if (!params.reactions.empty() && selected(config, "reaction_rates")) {
+        timing_t t = time_kernel(config.repetitions, [&]() { network.rates(C, T, cells, R); });
+        report("reaction_rates", fluid, 1 + 2 * config.substances, t);
+    }
+
+    if (!params.reactions.empty() && selected(config, "reaction_max_dt")) {
+        network.rates(C, T, cells, R);
+        timing_t t = time_kernel(config.repetitions, [&]() { reaction_max_dt(C, R, cells); });
+        report("reaction_max_dt", fluid, 2 * config.substances, t);
+    }
+
+    if (!params.reactions.empty() && selected(config, "compute_reaction")) {
+        network.rates(C, T, cells, R);
+        timing_t t = time_kernel(config.repetitions, [&]() { compute_reaction(C, T, cells, dt, params, R); });
+        report("compute_reaction", fluid, 2 + 3 * config.substances, t);
+    }
+
+    // Solve for a smooth right-hand side with zero mean, which is solvable
+    // with the Neumann boundaries of the box
+    double mean = 0;
+    fill_smooth(RS, 1, 0);
+    for (size_t r = 0; r < cells.fluid.size(); ++r)
+        for (int j = cells.fluid[r].jlow; j <= cells.fluid[r].jhigh; ++j) mean += RS[cells.fluid[r].i][j];
+    mean /= fluid;
+    for (size_t r = 0; r < cells.fluid.size(); ++r)
+        for (int j = cells.fluid[r].jlow; j <= cells.fluid[r].jhigh; ++j) RS[cells.fluid[r].i][j] -= mean;
+
+    for (int ordering = SOR_LEXICOGRAPHIC; ordering <= SOR_RED_BLACK; ++ordering) {
+        char const *name = ordering == SOR_LEXICOGRAPHIC ? "sor" : "sor_redblack";
+        if (!selected(config, name)) continue;
+
+        int iterations = 0;
+        timing_t t = time_kernel(std::min(config.repetitions, 3u), [&]() {
+            double res = DBL_MAX;
+            P.fill(0);
+            for (iterations = 0; iterations < (int)params.itermax && res > params.eps; ) {
+                ++iterations;
+                if (ordering == SOR_LEXICOGRAPHIC)
+                    sor(params.omg, params.dx, params.dy, imax, jmax, P, RS, &res, cells, params.wlvp, params.wrvp, params.wtvp, params.wbvp, 0, 0, 0, 0);
+                else
+                    sor_redblack(params.omg, params.dx, params.dy, imax, jmax, P, RS, &res, cells, params.wlvp, params.wrvp, params.wtvp, params.wbvp, 0, 0, 0, 0);
+            }
+        });
+        report(name, fluid, 3, t, iterations);
+    }
+
+    return 0;
+}
@@ -0,0 +1,236 @@
+#!/usr/bin/env python3
+"""
+End-to-end benchmark of the scenarios in conf/.
+
+Every scenario runs for a fixed number of time steps without output, from a
+copy of its configuration in a temporary directory. For each run the wall
+time, time steps per second, average pressure iterations and peak resident
+set size of sim, as it reports at exit, are recorded and written as JSON. A previous report can be
+given as baseline; runs that got slower by more than the tolerance are
+listed and make the script exit with status 1.
+
+With --scale 1,2,4 every geometry and initial value file is upsampled by
+each factor (pixel replication, which keeps obstacles valid) to show how the
+code paths scale with the grid size.
+
+--sor replaces or adds elements of the <sor> block of every scenario, e.g.
+--sor '<ordering>red-black</ordering>' to compare the solver settings.
+With --compare iterations the baseline check is on the average pressure
+iterations per time step instead of the speed, which is free of timing
+noise. Adaptive omega must never need more iterations than the fixed one:
+    python3 bench/scenarios.py --steps 100 --save fixed.json
+    python3 bench/scenarios.py --steps 100 --sor '<omega adapt="true">1.7</omega>' \
+        --baseline fixed.json --compare iterations --tolerance 0
+
+Example:
+    make && python3 bench/scenarios.py --steps 50 --save base.json
+    python3 bench/scenarios.py --steps 50 --baseline base.json
+"""
+
+import argparse
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+CONF_DIR = os.path.join(HERE, '..', '..', 'conf')
+SIM = os.path.join(HERE, '..', 'sim')
+
+SCENARIOS = ['wire', 'mixing', 'rayleigh_benard', 'reaction_drops',
+             'drops_in_cells', 'hot_drop', 'diffusion']
+
+
+def read_pgm(filename):
+    """ASCII (P2) pgm as list of rows, top row first"""
+    tokens = []
+    with open(filename) as f:
+        for line in f:
+            tokens += line.split('#', 1)[0].split()
+    if tokens[0] != 'P2':
+        raise ValueError(filename + ' is not an ASCII pgm file')
+    width, height, levels = int(tokens[1]), int(tokens[2]), int(tokens[3])
+    values = tokens[4:4 + width * height]
+    rows = [values[r * width:(r + 1) * width] for r in range(height)]
+    return rows, levels
+
+
+def write_pgm(filename, rows, levels):
+    with open(filename, 'w') as f:
+        f.write('P2\n%d %d\n%d\n' % (len(rows[0]), len(rows), levels))
+        for row in rows:
+            f.write(' '.join(row) + '\n')
+
+
+def upsample_pgm(source, target, factor):
+    rows, levels = read_pgm(source)
+    scaled = []
+    for row in rows:
+        wide = [value for value in row for _ in range(factor)]
+        scaled += [wide] * factor
+    write_pgm(target, scaled, levels)
+    return len(scaled[0]), len(scaled)
+
+
+def set_sor(config, elements):
+    """Replace the elements of the <sor> block given in elements, add the
+    others"""
+    for match in re.finditer(r'(<(\w+)[^>]*>.*?</\2>)', elements, flags=re.S):
+        whole, name = match.group(1), match.group(2)
+        block = re.search(r'<sor>.*?</sor>', config, flags=re.S).group(0)
+        pattern = r'<%s[\s>].*?</%s>' % (name, name)
+        if re.search(pattern, block, flags=re.S):
+            new_block = re.sub(pattern, lambda m: whole, block, count=1, flags=re.S)
+        else:
+            new_block = block.replace('</sor>', whole + '</sor>')
+        config = config.replace(block, new_block)
+    return config
+
+
+def prepare(scenario, workdir, steps, factor, sor=None):
+    """Copy a scenario into workdir, return the path of its configuration
+    and the size of its grid"""
+    with open(os.path.join(CONF_DIR, scenario + '.xml')) as f:
+        config = f.read()
+
+    # all referenced pgm files: geometry and initial values
+    grid = None
+    for name in set(re.findall(r'>\s*([^<>\s]+\.pgm)\s*<', config)):
+        source = os.path.join(CONF_DIR, name)
+        if factor == 1:
+            shutil.copy(source, os.path.join(workdir, name))
+            rows, _ = read_pgm(source)
+            size = (len(rows[0]), len(rows))
+        else:
+            size = upsample_pgm(source, os.path.join(workdir, name), factor)
+        if re.search(r'<geometry_file>\s*' + re.escape(name), config):
+            grid = size
+
+    # a fixed number of steps, no end time and no output
+    config = re.sub(r'<max>[^<]*</max>', '<max>1e30</max>', config)
+    config = re.sub(r'</time>', '<steps>%d</steps></time>' % steps, config, count=1)
+    config = re.sub(r'<output>.*?</output>',
+                    '<output><prefix>%s</prefix><dt_value>1e30</dt_value>'
+                    '<format>none</format></output>' % os.path.join(workdir, scenario),
+                    config, count=1, flags=re.S)
+
+    if sor:
+        config = set_sor(config, sor)
+
+    filename = os.path.join(workdir, scenario + '.xml')
+    with open(filename, 'w') as f:
+        f.write(config)
+    return filename, grid
+
+
+def run(sim, scenario, steps, factor, sor=None):
+    workdir = tempfile.mkdtemp(prefix='bench_' + scenario + '_')
+    try:
+        config, grid = prepare(scenario, workdir, steps, factor, sor)
+
+        # relative file names in the configuration are resolved from there
+        start = time.time()
+        process = subprocess.Popen([sim, config], cwd=workdir,
+                                   stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        output = process.stdout.read().decode('latin1')
+        status = process.wait()
+        wall = time.time() - start
+    finally:
+        shutil.rmtree(workdir)
+
+    if status != 0 or 'Error' in output:
+        sys.stderr.write(output[-2000:])
+        raise RuntimeError('%s failed with status %d' % (scenario, status))
+
+    iterations = [int(i) for i in re.findall(r'SOR iterations: (\d+)', output)]
+    # the peak of wait4 would be the one of this script, it survives the exec
+    peak = re.search(r'Peak memory: (\d+) kB', output)
+    return {
+        'scenario': scenario,
+        'scale': factor,
+        'imax': grid[0],
+        'jmax': grid[1],
+        'steps': len(iterations),
+        'wall_s': wall,
+        'steps_per_s': len(iterations) / wall,
+        'avg_iterations': sum(iterations) / float(max(len(iterations), 1)),
+        'peak_rss_kb': int(peak.group(1)) if peak else 0,
+    }
+
+
+def compare(results, baseline, tolerance, metric):
+    """Print the ratio to the baseline, return the regressions. The ratio is
+    baseline / run for iterations, so below 1 is worse for either metric"""
+    previous = dict(('%s@%d' % (r['scenario'], r['scale']), r) for r in baseline['runs'])
+    regressions = []
+    field = 'avg_iterations' if metric == 'iterations' else 'steps_per_s'
+
+    print('\n%-24s %12s %12s %8s' % ('run', 'avg it' if metric == 'iterations' else 'steps/s',
+                                      'baseline', 'ratio'))
+    for r in results:
+        key = '%s@%d' % (r['scenario'], r['scale'])
+        if key not in previous:
+            print('%-24s %12.2f %12s' % (key, r[field], '-'))
+            continue
+        if metric == 'iterations':
+            ratio = previous[key][field] / r[field]
+        else:
+            ratio = r[field] / previous[key][field]
+        worse = ratio < 1 - tolerance
+        print('%-24s %12.2f %12.2f %8.3f%s' % (key, r[field], previous[key][field],
+                                               ratio, '  WORSE' if worse else ''))
+        if worse:
+            regressions.append(key)
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description='End-to-end benchmark of the scenarios in conf/')
+    parser.add_argument('scenarios', nargs='*', default=SCENARIOS, help='default: all')
+    parser.add_argument('--sim', default=SIM, help='simulation binary, default: src/sim')
+    parser.add_argument('--steps', type=int, default=50, help='time steps per run (default 50)')
+    parser.add_argument('--scale', default='1', help='comma separated upsampling factors (default 1)')
+    parser.add_argument('--save', help='write the report to this file')
+    parser.add_argument('--baseline', help='compare with a previously saved report')
+    parser.add_argument('--tolerance', type=float, default=0.1,
+                        help='allowed slowdown against the baseline (default 0.1)')
+    parser.add_argument('--compare', choices=['speed', 'iterations'], default='speed',
+                        help='what the baseline check is on (default speed)')
+    parser.add_argument('--sor', help='XML elements replacing those in the <sor> block')
+    args = parser.parse_args()
+
+    sim = os.path.abspath(args.sim)
+    factors = [int(k) for k in args.scale.split(',')]
+
+    print('%-16s %5s %10s %6s %9s %9s %8s %10s' % ('scenario', 'scale', 'grid', 'steps',
+                                                   'wall [s]', 'steps/s', 'avg it', 'RSS [MB]'))
+    results = []
+    for scenario in args.scenarios:
+        for factor in factors:
+            r = run(sim, scenario, args.steps, factor, args.sor)
+            results.append(r)
+            print('%-16s %5d %10s %6d %9.3f %9.2f %8.1f %10.1f' % (
+                scenario, factor, '%dx%d' % (r['imax'], r['jmax']), r['steps'],
+                r['wall_s'], r['steps_per_s'], r['avg_iterations'], r['peak_rss_kb'] / 1024.0))
+            sys.stdout.flush()
+
+    report = {'sim': sim, 'steps': args.steps, 'sor': args.sor, 'runs': results}
+    if args.save:
+        with open(args.save, 'w') as f:
+            json.dump(report, f, indent=2)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            regressions = compare(results, json.load(f), args.tolerance, args.compare)
+        if regressions:
+            print('\nWorse than the baseline: ' + ', '.join(regressions))
+            return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -1,6 +1,16 @@
 #include "boundary_conditions.h"
 
 #include <algorithm>
+#include <map>
+
+static std::map<std::string,int> boundary_condition = {
+    {"dirichlet", BC_DIRICHLET},
+    {"neumann",   BC_NEUMANN},
+    {"no-slip",   BC_NO_SLIP},
+    {"free-slip", BC_FREE_SLIP},
+    {"outflow",   BC_OUTFLOW},
+    {"pressure",  BC_PRESSURE},
+};
 
 int parse_boundary_condition (std::string type)
 {
@@ -1,16 +1,17 @@
 #ifndef BOUNDARY_CONDITIONS_H9X5XKBA
 #define BOUNDARY_CONDITIONS_H9X5XKBA
 
-#include <map>
 #include <string>
 
-static std::map<std::string,int> boundary_condition = {
-    {"dirichlet", 0},
-    {"neumann",   1},
-    {"no-slip",   2},
-    {"free-slip", 3},
-    {"outflow",   4},
-    {"pressure",  5},
+// Boundary condition types as stored in Parameters. Kernels compare against
+// these constants, the names are only needed to parse the configuration.
+enum boundary_type {
+    BC_DIRICHLET = 0,
+    BC_NEUMANN   = 1,
+    BC_NO_SLIP   = 2,
+    BC_FREE_SLIP = 3,
+    BC_OUTFLOW   = 4,
+    BC_PRESSURE  = 5
 };
 
 
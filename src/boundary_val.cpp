@@ -10,10 +10,10 @@
  */
 void domain_boundary_values(
   const Parameters &parameters,
-  double **U,
-  double **V,
-  double **T,
-  double ***C
+  Field2D<double> &U,
+  Field2D<double> &V,
+  Field2D<double> &T,
+  std::vector<Field2D<double> > &C
 ) {
     // Seems to me like the less expensive way to do is just to write a lot
     // just to avoid a lot of comparisons, so let's begin
@@ -23,21 +23,21 @@ void domain_boundary_values(
 
     // Left wall
 
-    if (parameters.wlvp == boundary_condition["no-slip"]){
+    if (parameters.wlvp == BC_NO_SLIP){
         for (int j = 1; j <= parameters.jmax; j++){
             U[0][j] = 0;
             V[0][j] = -V[1][j];
         }
     }
 
-    else if (parameters.wlvp == boundary_condition["free-slip"]) {
+    else if (parameters.wlvp == BC_FREE_SLIP) {
         for (int j = 1; j <= parameters.jmax; j++){
             U[0][j] = 0;
             V[0][j] = V[1][j];
         }
     }
 
-    else if (parameters.wlvp == boundary_condition["outflow"]) {
+    else if (parameters.wlvp == BC_OUTFLOW) {
         for (int j = 1; j <= parameters.jmax; j++){
             U[0][j] = U[1][j];
             V[0][j] = V[1][j];
@@ -45,12 +45,12 @@ void domain_boundary_values(
     }
 
 
-    if ( parameters.wlt == boundary_condition["dirichlet"] ){ // Fixed temperature
+    if ( parameters.wlt == BC_DIRICHLET ){ // Fixed temperature
         for (int j = 1; j <= parameters.jmax; j++){
             T[0][j] = 2 * parameters.tl - T[1][j];
         }
     }
-    else if ( parameters.wlt == boundary_condition["neumann"] ){ // Uniform Neumann condition
+    else if ( parameters.wlt == BC_NEUMANN ){ // Uniform Neumann condition
         for (int j = 1; j <= parameters.jmax; j++){
             T[0][j] = T[1][j] - parameters.dx * parameters.tl;
         }
@@ -59,33 +59,33 @@ void domain_boundary_values(
 
     // Right wall
 
-    if (parameters.wrvp == boundary_condition["no-slip"]){
+    if (parameters.wrvp == BC_NO_SLIP){
         for (int j = 1; j <= parameters.jmax; j++){
             U[parameters.imax][j] = 0;
             V[parameters.imax+1][j] = -V[parameters.imax][j];
         }
     }
 
-    else if(parameters.wrvp == boundary_condition["free-slip"]){
+    else if(parameters.wrvp == BC_FREE_SLIP){
         for (int j = 1; j <= parameters.jmax; j++){
             U[parameters.imax][j] = 0;
             V[parameters.imax+1][j] = V[parameters.imax][j];
         }
     }
 
-    else if (parameters.wrvp == boundary_condition["outflow"]){
+    else if (parameters.wrvp == BC_OUTFLOW){
         for (int j = 1; j <= parameters.jmax; j++){
             U[parameters.imax][j] = U[parameters.imax-1][j];
             V[parameters.imax+1][j] = V[parameters.imax][j];
         }
     }
 
-    if ( parameters.wrt == boundary_condition["dirichlet"] ){ // Fixed temperature
+    if ( parameters.wrt == BC_DIRICHLET ){ // Fixed temperature
         for (int j = 1; j <= parameters.jmax; j++){
             T[parameters.imax + 1][j] = 2 * parameters.tr - T[parameters.imax][j];
         }
     }
-    else if ( parameters.wrt == boundary_condition["neumann"] ){ // Uniform Neumann condition
+    else if ( parameters.wrt == BC_NEUMANN ){ // Uniform Neumann condition
         for (int j = 1; j <= parameters.jmax; j++){
             T[parameters.imax + 1][j] = T[parameters.imax][j] - parameters.dx * parameters.tr;
         }
@@ -94,33 +94,33 @@ void domain_boundary_values(
 
     // Upper wall
 
-    if (parameters.wtvp == boundary_condition["no-slip"]) {
+    if (parameters.wtvp == BC_NO_SLIP) {
         for (int i = 1; i <= parameters.imax; i++){
             U[i][parameters.jmax+1] = -U[i][parameters.jmax];
             V[i][parameters.jmax] = 0;
         }
     }
 
-    else if(parameters.wtvp == boundary_condition["free-slip"]) {
+    else if(parameters.wtvp == BC_FREE_SLIP) {
         for (int i = 1; i <= parameters.imax; i++){
             U[i][parameters.jmax+1] = U[i][parameters.jmax];
             V[i][parameters.jmax] = 0;
         }
     }
 
-    else if (parameters.wtvp == boundary_condition["outflow"]) {
+    else if (parameters.wtvp == BC_OUTFLOW) {
         for (int i = 1; i <= parameters.imax; i++){
             U[i][parameters.jmax+1] = U[i][parameters.jmax];
             V[i][parameters.jmax] = V[i][parameters.jmax-1];
         }
     }
 
-    if ( parameters.wtt == boundary_condition["dirichlet"] ){ // Fixed temperature
+    if ( parameters.wtt == BC_DIRICHLET ){ // Fixed temperature
         for (int i = 1; i <= parameters.imax; i++){
             T[i][parameters.jmax + 1] = 2 * parameters.tt - T[i][parameters.jmax];
         }
     }
-    else if ( parameters.wtt == boundary_condition["neumann"] ){ // Uniform Neumann condition
+    else if ( parameters.wtt == BC_NEUMANN ){ // Uniform Neumann condition
         for (int i = 1; i <= parameters.imax; i++){
             T[i][parameters.jmax + 1] = T[i][parameters.jmax] - parameters.dy * parameters.tt;
         }
@@ -129,33 +129,33 @@ void domain_boundary_values(
 
     // Bottom wall
 
-    if (parameters.wbvp == boundary_condition["no-slip"]) {
+    if (parameters.wbvp == BC_NO_SLIP) {
         for (int i = 1; i <= parameters.imax; i++){
             U[i][0] = -U[i][1];
             V[i][0] = 0;
         }
     }
 
-    else if(parameters.wbvp == boundary_condition["free-slip"]) {
+    else if(parameters.wbvp == BC_FREE_SLIP) {
         for (int i = 1; i <= parameters.imax; i++){
             U[i][0] = U[i][1];
             V[i][0] = 0;
         }
     }
 
-    else if (parameters.wbvp == boundary_condition["outflow"]) {
+    else if (parameters.wbvp == BC_OUTFLOW) {
         for (int i = 1; i <= parameters.imax; i++){
             U[i][0] = U[i][1];
             V[i][0] = V[i][1];
         }
     }
 
-    if ( parameters.wbt == boundary_condition["dirichlet"] ){ // Fixed temperature
+    if ( parameters.wbt == BC_DIRICHLET ){ // Fixed temperature
         for (int i = 1; i <= parameters.imax; i++){
             T[i][0] = 2 * parameters.tb - T[i][1];
         }
     }
-    else if ( parameters.wbt == boundary_condition["neumann"] ){ // Uniform Neumann condition
+    else if ( parameters.wbt == BC_NEUMANN ){ // Uniform Neumann condition
         for (int i = 1; i <= parameters.imax; i++){
             T[i][0] = T[i][1] - parameters.dy * parameters.tb;
         }
@@ -181,9 +181,9 @@ void domain_boundary_values(
 void spec_boundary_val(
         const char *problem,
         const Parameters & parameters,
-        double **U,
-        double **V,
-        double ***C
+        Field2D<double> &U,
+        Field2D<double> &V,
+        std::vector<Field2D<double> > &C
 ) {
     if (!strcmp(problem, "Wire")) { // Flow around a wire
         // loop over the inflow boundary
@@ -227,29 +227,24 @@ void spec_boundary_val(
 }
 
 
-enum obstacle_iface_orientation {
-    IFACE_IS_NORTH = 1,      // upper neighbour is a fluid cell
-    IFACE_IS_SOUTH = 2,      // lower neighbour is a fluid cell
-    IFACE_IS_WEST  = 4,      // left  neighbour is a fluid cell
-    IFACE_IS_EAST  = 8       // right neighbour is a fluid cell
-};
-
-
 void inner_boundary_values(
   int imax,
   int jmax,
-  double **U,
-  double **V,
-  double **P,
-  double **F,
-  double **G,
-  int **Flag
+  Field2D<double> &U,
+  Field2D<double> &V,
+  Field2D<double> &P,
+  Field2D<double> &F,
+  Field2D<double> &G,
+  CellLists const &cells
 ) {
-    // loop through inner Flag field
-    for (int i = 1; i <= imax; ++i) {
-        for (int j = 1; j <= jmax; ++j) {
+    // loop through the obstacle boundary cells, one orientation at a time
+    for (int o = 1; o < 16; ++o) {
+        for (size_t n = 0; n < cells.boundary[o].size(); ++n) {
+            int i = cells.boundary[o][n].i;
+            int j = cells.boundary[o][n].j;
+
             // set no-slip conditions at obstacle cells
-            switch (Flag[i][j]) {
+            switch (o) {
                 case IFACE_IS_NORTH:
                     // ws3 eq1.4 according to ws1 eq14-17
                     V[i  ][j]  =   0;
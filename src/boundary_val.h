@@ -1,6 +1,10 @@
 #ifndef __RANDWERTE_H__
 #define __RANDWERTE_H__
 
+#include "field2d.h"
+#include "cell_lists.h"
+#include <vector>
+
 // forward decl.
 class Parameters;
 
@@ -9,21 +13,21 @@ class Parameters;
  */
 void domain_boundary_values(
   const Parameters &parameters,
-  double **U,
-  double **V,
-  double **T,
-  double ***C
+  Field2D<double> &U,
+  Field2D<double> &V,
+  Field2D<double> &T,
+  std::vector<Field2D<double> > &C
 );
 
 void inner_boundary_values(
   int imax,
   int jmax,
-  double **U,
-  double **V,
-  double **P,
-  double **F,
-  double **G,
-  int **Flag
+  Field2D<double> &U,
+  Field2D<double> &V,
+  Field2D<double> &P,
+  Field2D<double> &F,
+  Field2D<double> &G,
+  CellLists const &cells
 );
 
 
@@ -34,9 +38,9 @@ void inner_boundary_values(
 void spec_boundary_val(
         const char *problem,
         const Parameters & parameters,
-        double **U,
-        double **V,
-        double ***C
+        Field2D<double> &U,
+        Field2D<double> &V,
+        std::vector<Field2D<double> > &C
 );
 
 
@@ -0,0 +1,74 @@
+#include "cell_lists.h"
+
+// Append the runs of cells in row i for which the predicate holds
+template <typename Pred>
+static void add_runs (std::vector<cell_run_t> &runs, int i, int jmax, Pred in)
+{
+    for (int j = 1; j <= jmax; ++j) {
+        if (!in(j)) continue;
+
+        cell_run_t run;
+        run.i    = i;
+        run.jlow = j;
+        while (j < jmax && in(j + 1)) ++j;
+        run.jhigh = j;
+        runs.push_back(run);
+    }
+}
+
+void CellLists::build (Field2D<int> const &Flag)
+{
+    int imax = Flag.imax(), jmax = Flag.jmax();
+
+    fluid.clear();
+    u_faces.clear();
+    v_faces.clear();
+    for (int o = 0; o < 16; ++o) boundary[o].clear();
+    solid.clear();
+    nof_fluid = 0;
+
+    fluid_row.assign(imax + 2, 0);
+    u_faces_row.assign(imax + 2, 0);
+    v_faces_row.assign(imax + 2, 0);
+
+    for (int i = 1; i <= imax; ++i) {
+        fluid_row[i]   = fluid.size();
+        u_faces_row[i] = u_faces.size();
+        v_faces_row[i] = v_faces.size();
+
+        int const *f  = Flag[i];
+        int const *fe = Flag[i+1];
+
+        add_runs(fluid,   i, jmax, [=](int j) { return (f[j] & 16) != 0; });
+        add_runs(u_faces, i, jmax, [=](int j) { return (f[j] & 16) && (fe[j] & 16); });
+        add_runs(v_faces, i, jmax, [=](int j) { return (f[j] & 16) && (f[j+1] & 16); });
+
+        for (int j = 1; j <= jmax; ++j) {
+            cell_t cell;
+            cell.i = i;
+            cell.j = j;
+
+            if (f[j] & 16)  nof_fluid++;
+            else if (f[j])  boundary[f[j] & 15].push_back(cell);
+            else            solid.push_back(cell);
+        }
+    }
+
+    fluid_row[imax + 1]   = fluid.size();
+    u_faces_row[imax + 1] = u_faces.size();
+    v_faces_row[imax + 1] = v_faces.size();
+
+    fluid_columns.clear();
+    for (int j = 1; j <= jmax; ++j) {
+        for (int i = 1; i <= imax; ++i) {
+            if (!(Flag[i][j] & 16)) continue;
+
+            cell_column_t column;
+            column.j    = j;
+            column.ilow = i;
+            while (i < imax && (Flag[i+1][j] & 16)) ++i;
+            column.ihigh = i;
+            fluid_columns.push_back(column);
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef CELL_LISTS_K7D2XW4P
+#define CELL_LISTS_K7D2XW4P
+
+#include "field2d.h"
+#include <vector>
+
+// Orientation of an obstacle boundary cell, the flag bits of its fluid
+// neighbours. Corner cells have two of them set.
+enum obstacle_iface_orientation {
+    IFACE_IS_NORTH = 1,      // upper neighbour is a fluid cell
+    IFACE_IS_SOUTH = 2,      // lower neighbour is a fluid cell
+    IFACE_IS_WEST  = 4,      // left  neighbour is a fluid cell
+    IFACE_IS_EAST  = 8       // right neighbour is a fluid cell
+};
+
+// Cells [i][jlow..jhigh], contiguous in memory
+struct cell_run_t {
+    int i, jlow, jhigh;
+};
+
+// Cells [ilow..ihigh][j], a column of cells
+struct cell_column_t {
+    int j, ilow, ihigh;
+};
+
+struct cell_t {
+    int i, j;
+};
+
+/**
+ * Cells of the inner domain (1..imax, 1..jmax) sorted by their type. The
+ * geometry doesn't change, so the lists are built once from the Flag field
+ * and the kernels loop over them instead of testing Flag in every cell.
+ *
+ * Runs are ordered by i, then j, i.e. in the order of the old nested loops.
+ */
+class CellLists {
+    public:
+        void build (Field2D<int> const &Flag);
+
+        // BEWARE: public, direct access possible
+        std::vector<cell_run_t> fluid;      // fluid cells
+        std::vector<cell_run_t> u_faces;    // fluid cells with a fluid east neighbour
+        std::vector<cell_run_t> v_faces;    // fluid cells with a fluid north neighbour
+        std::vector<cell_column_t> fluid_columns; // fluid cells again, as columns ordered by j
+        std::vector<cell_t> boundary[16];   // obstacle cells, by orientation. Entry 0 is unused
+        std::vector<cell_t> solid;          // obstacle cells without fluid neighbours
+        int nof_fluid;
+
+        // The runs of row i are [fluid_row[i], fluid_row[i+1]), likewise for
+        // the faces. Indexed 1..imax+1, for kernels that work row by row
+        std::vector<size_t> fluid_row, u_faces_row, v_faces_row;
+};
+
+#endif /* end of include guard: CELL_LISTS_K7D2XW4P */
@@ -0,0 +1,145 @@
+#include "checkpoint.h"
+#include "Parameters.h"
+#include "helper.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static char const checkpoint_magic[8] = {'N', 'S', 'C', 'H', 'K', 'P', 'T', '1'};
+
+// Padded to 128 bytes, which keeps the field data after it 64-byte aligned
+// in the mapped file
+struct checkpoint_header_t {
+    char     magic[8];
+    uint64_t params_hash;
+    int32_t  imax, jmax, ghost, stride;
+    uint32_t nof_fields;
+    uint32_t n;
+    double   t, dt;
+    double   next_printing_time;
+    double   next_checkpoint_time;
+    double   omg;
+    uint32_t nof_omega;         // doubles after the fields
+    uint32_t nof_monitor;       // doubles after those
+    char     reserved[40];
+};
+
+static_assert(sizeof(checkpoint_header_t) == 128, "checkpoint header must be 128 bytes");
+
+
+static void write_all (int fd, void const *buffer, size_t size, std::string const &filename)
+{
+    char const *p = static_cast<char const *>(buffer);
+    while (size > 0) {
+        ssize_t written = ::write(fd, p, size);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) ERROR(("Failed to write checkpoint " + filename).c_str());
+        p    += written;
+        size -= written;
+    }
+}
+
+
+void write_checkpoint (std::string const &filename, Parameters const &params,
+                       loop_state_t const &state,
+                       std::vector<Field2D<double> const *> const &fields)
+{
+    Field2D<double> const &first = *fields[0];
+
+    checkpoint_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+    header.params_hash = params.hash();
+    header.imax        = first.imax();
+    header.jmax        = first.jmax();
+    header.ghost       = first.ghost();
+    header.stride      = first.stride();
+    header.nof_fields  = fields.size();
+    header.n           = state.n;
+    header.t           = state.t;
+    header.dt          = state.dt;
+    header.next_printing_time   = state.next_printing_time;
+    header.next_checkpoint_time = state.next_checkpoint_time;
+    header.omg         = state.omg;
+    header.nof_omega   = state.omega.size();
+    header.nof_monitor = state.monitor.size();
+
+    std::string tmp = filename + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) ERROR(("Failed to open " + tmp).c_str());
+
+    write_all(fd, &header, sizeof(header), tmp);
+    for (size_t k = 0; k < fields.size(); ++k) {
+        assert(fields[k]->size() == first.size());
+        write_all(fd, fields[k]->data(), fields[k]->size() * sizeof(double), tmp);
+    }
+    if (!state.omega.empty()) {
+        write_all(fd, &state.omega[0], state.omega.size() * sizeof(double), tmp);
+    }
+    if (!state.monitor.empty()) {
+        write_all(fd, &state.monitor[0], state.monitor.size() * sizeof(double), tmp);
+    }
+
+    if (::fsync(fd) != 0 || ::close(fd) != 0) ERROR(("Failed to write checkpoint " + tmp).c_str());
+    if (::rename(tmp.c_str(), filename.c_str()) != 0) ERROR(("Failed to rename " + tmp).c_str());
+}
+
+
+void read_checkpoint (std::string const &filename, Parameters const &params,
+                      loop_state_t &state,
+                      std::vector<Field2D<double> *> const &fields)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) ERROR(("Failed to open checkpoint " + filename).c_str());
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) ERROR(("Failed to stat checkpoint " + filename).c_str());
+    size_t file_size = st.st_size;
+    if (file_size < sizeof(checkpoint_header_t)) ERROR(("Truncated checkpoint " + filename).c_str());
+
+    void *mapped = ::mmap(0, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) ERROR(("Failed to map checkpoint " + filename).c_str());
+    ::close(fd);
+
+    checkpoint_header_t header;
+    memcpy(&header, mapped, sizeof(header));
+
+    Field2D<double> const &first = *fields[0];
+    size_t field_bytes = first.size() * sizeof(double);
+
+    if (memcmp(header.magic, checkpoint_magic, sizeof(header.magic)) != 0)
+        ERROR((filename + " is not a checkpoint").c_str());
+    if (header.imax != first.imax() || header.jmax != first.jmax() ||
+        header.ghost != first.ghost() || header.stride != first.stride())
+        ERROR(("Grid of checkpoint " + filename + " doesn't match the geometry").c_str());
+    if (header.nof_fields != fields.size())
+        ERROR(("Checkpoint " + filename + " has a different number of fields").c_str());
+    if (header.params_hash != params.hash())
+        ERROR(("Checkpoint " + filename + " was written with different parameters").c_str());
+    if (file_size != sizeof(header) + fields.size() * field_bytes +
+                     (header.nof_omega + header.nof_monitor) * sizeof(double))
+        ERROR(("Truncated checkpoint " + filename).c_str());
+
+    char const *data = static_cast<char const *>(mapped) + sizeof(header);
+    for (size_t k = 0; k < fields.size(); ++k) {
+        memcpy(fields[k]->data(), data + k * field_bytes, field_bytes);
+    }
+    double const *omega = reinterpret_cast<double const *>(data + fields.size() * field_bytes);
+    state.omega.assign(omega, omega + header.nof_omega);
+    double const *monitor = omega + header.nof_omega;
+    state.monitor.assign(monitor, monitor + header.nof_monitor);
+
+    state.n  = header.n;
+    state.t  = header.t;
+    state.dt = header.dt;
+    state.next_printing_time   = header.next_printing_time;
+    state.next_checkpoint_time = header.next_checkpoint_time;
+    state.omg = header.omg;
+
+    ::munmap(mapped, file_size);
+}
@@ -0,0 +1,48 @@
+#ifndef CHECKPOINT_R5NV2K8C
+#define CHECKPOINT_R5NV2K8C
+
+#include "field2d.h"
+#include <string>
+#include <vector>
+
+// forward declaration
+class Parameters;
+
+// The scalars of the time loop, stored along with the fields
+struct loop_state_t {
+    double t;
+    double dt;
+    unsigned int n;
+    double next_printing_time;
+    double next_checkpoint_time;
+    double omg;                 // relaxation factor of the SOR solvers
+    std::vector<double> omega;      // state of the omega tuner besides omg
+    std::vector<double> monitor;    // state of the steady state monitor
+};
+
+/**
+ * Writes a binary checkpoint: a header with the grid dimensions, a hash of
+ * the parameters and the loop state, followed by the complete storage of
+ * every field (ghost layers and padding included), one write per field, and
+ * the states of the omega tuner and the steady state monitor.
+ *
+ * The file is written to filename.tmp first and renamed when complete, so an
+ * interrupted write leaves the previous checkpoint intact.
+ */
+void write_checkpoint (std::string const &filename, Parameters const &params,
+                       loop_state_t const &state,
+                       std::vector<Field2D<double> const *> const &fields);
+
+/**
+ * Restores fields and loop state from a checkpoint written by
+ * write_checkpoint() with the same list of fields. The file is mapped into
+ * memory and each field copied from it in one piece.
+ *
+ * Terminates the program if the file doesn't match the grid, the number of
+ * fields or the parameters of this run.
+ */
+void read_checkpoint (std::string const &filename, Parameters const &params,
+                      loop_state_t &state,
+                      std::vector<Field2D<double> *> const &fields);
+
+#endif /* end of include guard: CHECKPOINT_R5NV2K8C */
@@ -0,0 +1,230 @@
+#include "fast_poisson.h"
+#include "Parameters.h"
+#include "boundary_conditions.h"
+#include "sor.h"
+#include <math.h>
+
+
+FastPoisson::FastPoisson (Parameters const &params)
+    : params(params),
+      dirichlet_left (params.wlvp == BC_PRESSURE),
+      dirichlet_right(params.wrvp == BC_PRESSURE),
+      inv_pivot(params.jmax, params.imax, 0),
+      W        (params.imax, params.jmax, 0)
+{
+    int imax = params.imax, jmax = params.jmax;
+    double idx2 = 1 / (params.dx * params.dx), idy2 = 1 / (params.dy * params.dy);
+
+    roots.resize(jmax);
+    shift.resize(jmax);
+    for (int m = 0; m < jmax; ++m) {
+        roots[m] = std::polar(1.0, -2 * M_PI * m / jmax);
+        shift[m] = std::polar(1.0, -M_PI * m / (2 * jmax));
+    }
+
+    // LU decomposition of (-d^2/dx^2 + mu_k) for every mode k, where mu_k is
+    // the eigenvalue of -d^2/dy^2 with Neumann walls. Behind a Dirichlet wall
+    // the ghost value is 2*p_wall - P, which adds idx2 to the diagonal.
+    // Mode k is stored in column k+1.
+    for (int k = 0; k < jmax; ++k) {
+        double mu = 2 * idy2 * (1 - cos(M_PI * k / jmax));
+        double pivot = 0;
+
+        for (int i = 1; i <= imax; ++i) {
+            double diag = mu + 2 * idx2;
+            if (i == 1)    diag += dirichlet_left  ? idx2 : -idx2;
+            if (i == imax) diag += dirichlet_right ? idx2 : -idx2;
+            if (i > 1)     diag -= idx2 * idx2 / pivot;
+            pivot = diag;
+            inv_pivot[k+1][i] = 1 / pivot;
+        }
+
+        // The constant mode with Neumann walls all around is singular, its
+        // last pivot is zero. The value of the last cell is arbitrary then.
+        if (k == 0 && !dirichlet_left && !dirichlet_right) inv_pivot[k+1][imax] = 0;
+    }
+}
+
+
+bool FastPoisson::applicable (Parameters const &params, Field2D<int> const &Flag)
+{
+    for (int i = 1; i <= params.imax; ++i) {
+        for (int j = 1; j <= params.jmax; ++j) {
+            if (!(Flag[i][j] & 16)) return false;
+        }
+    }
+    return true;
+}
+
+
+unsigned int FastPoisson::solve (Field2D<double> &P, Field2D<double> &RS, double *res, double *psum)
+{
+    int imax = params.imax, jmax = params.jmax;
+    double idx2 = 1 / (params.dx * params.dx);
+
+    // Without any Dirichlet wall only the part of RS with zero mean can be
+    // matched, the rest would keep the residual from ever dropping below eps.
+    double mean = 0;
+    if (!dirichlet_left && !dirichlet_right) {
+        #pragma omp parallel for reduction(+:mean)
+        for (int i = 1; i <= imax; ++i) {
+            for (int j = 1; j <= jmax; ++j) {
+                mean += RS[i][j];
+            }
+        }
+        mean /= imax * jmax;
+    }
+
+    // Nothing to do if P still solves the equation, e.g. without any flow
+    double p_sum;
+    *res = residual(P, RS, mean, &p_sum);
+    if (*res <= params.eps) {
+        if (psum) *psum = p_sum;
+        return 0;
+    }
+
+    #pragma omp parallel
+    {
+        std::vector<complex_t> v(jmax), V(jmax), s(jmax);
+        std::vector<double> b(jmax);
+
+        // Right-hand side of -laplace(P) = -RS, transformed column by column
+        #pragma omp for
+        for (int i = 1; i <= imax; ++i) {
+            for (int j = 1; j <= jmax; ++j) {
+                b[j-1] = mean - RS[i][j];
+                if (i == 1    && dirichlet_left)  b[j-1] += 2 * idx2 * params.pl;
+                if (i == imax && dirichlet_right) b[j-1] += 2 * idx2 * params.pr;
+            }
+            dct(&b[0], &W[i][1], v, V, s);
+        }
+
+        // One tridiagonal system per mode, in column k
+        #pragma omp for
+        for (int k = 1; k <= jmax; ++k) {
+            for (int i = 2; i <= imax; ++i) {
+                W[i][k] += idx2 * W[i-1][k] * inv_pivot[k][i-1];
+            }
+            W[imax][k] *= inv_pivot[k][imax];
+            for (int i = imax - 1; i >= 1; --i) {
+                W[i][k] = (W[i][k] + idx2 * W[i+1][k]) * inv_pivot[k][i];
+            }
+
+            // The sum of column i of P is W[i][1], see idct(). Without any
+            // Dirichlet wall a constant is free, the mean is removed here
+            if (k == 1) {
+                p_sum = 0;
+                for (int i = 1; i <= imax; ++i) p_sum += W[i][1];
+                if (!dirichlet_left && !dirichlet_right) {
+                    for (int i = 1; i <= imax; ++i) W[i][1] -= p_sum / imax;
+                    p_sum = 0;
+                }
+            }
+        }
+
+        // Back to the cell values
+        #pragma omp for
+        for (int i = 1; i <= imax; ++i) {
+            idct(&W[i][1], &P[i][1], v, V, s);
+        }
+    }
+
+    sor_domain_boundaries(imax, jmax, P, params.wlvp, params.wrvp, params.wtvp, params.wbvp, params.pl, params.pr, params.pt, params.pb);
+
+    // down to round-off
+    *res = residual(P, RS, mean);
+    if (psum) *psum = p_sum;
+
+    return 1;
+}
+
+
+// RMS of the residual with the mean of RS removed. The ghost values of P
+// must be set. psum, if given, receives the sum of P.
+double FastPoisson::residual (Field2D<double> &P, Field2D<double> &RS, double mean, double *psum) const
+{
+    int imax = params.imax, jmax = params.jmax;
+    double idx2 = 1 / (params.dx * params.dx), idy2 = 1 / (params.dy * params.dy);
+
+    double rloc = 0, sum = 0;
+    #pragma omp parallel for reduction(+:rloc,sum)
+    for (int i = 1; i <= imax; ++i) {
+        for (int j = 1; j <= jmax; ++j) {
+            double r = (P[i+1][j]-2.0*P[i][j]+P[i-1][j]) * idx2 + (P[i][j+1]-2.0*P[i][j]+P[i][j-1]) * idy2 - (RS[i][j] - mean);
+            rloc += r*r;
+            sum  += P[i][j];
+        }
+    }
+    if (psum) *psum = sum;
+    return sqrt(rloc / (imax * jmax));
+}
+
+
+// X_k = sum_n x_n cos(pi k (n + 1/2) / N), computed with a single FFT of
+// length N: the even samples in order followed by the odd ones in reverse.
+void FastPoisson::dct (double const *x, double *X, std::vector<complex_t> &v, std::vector<complex_t> &V,
+                       std::vector<complex_t> &s) const
+{
+    int N = params.jmax;
+
+    for (int n = 0; 2 * n < N; ++n)     v[n]         = x[2*n];
+    for (int n = 0; 2 * n + 1 < N; ++n) v[N - 1 - n] = x[2*n + 1];
+
+    fft(&v[0], &V[0], N, 1, 1, &s[0]);
+
+    for (int k = 0; k < N; ++k) X[k] = (shift[k] * V[k]).real();
+}
+
+
+// Inverse of dct(). The FFT of v is recovered from X_k and X_{N-k} since v
+// is real. Its inverse is done by a forward FFT of the conjugate, of which
+// only the real part is needed.
+void FastPoisson::idct (double const *X, double *x, std::vector<complex_t> &v, std::vector<complex_t> &V,
+                        std::vector<complex_t> &s) const
+{
+    int N = params.jmax;
+
+    V[0] = X[0];
+    for (int k = 1; k < N; ++k) V[k] = shift[k] * complex_t(X[k], X[N-k]);
+
+    fft(&V[0], &v[0], N, 1, 1, &s[0]);
+
+    for (int n = 0; 2 * n < N; ++n)     x[2*n]     = v[n].real()         / N;
+    for (int n = 0; 2 * n + 1 < N; ++n) x[2*n + 1] = v[N - 1 - n].real() / N;
+}
+
+
+// Recursive mixed radix FFT: out[k] = sum_m in[m * stride] w^(m k) with
+// w = roots[wstride], n = jmax / wstride. The smallest factor p of n is split
+// off, p = n for prime lengths, which then costs O(n^2). s holds the p
+// inputs of a butterfly, it is free again once a sub-transform returns.
+void FastPoisson::fft (complex_t const *in, complex_t *out, int n, int stride, int wstride, complex_t *s) const
+{
+    if (n == 1) {
+        out[0] = in[0];
+        return;
+    }
+
+    int p = 2;
+    while (n % p != 0) ++p;
+    int m = n / p;
+
+    // p interleaved sub-transforms of length m, stored one after the other
+    for (int r = 0; r < p; ++r) {
+        fft(in + r * stride, out + r * m, m, stride * p, wstride * p, s);
+    }
+
+    // Butterflies of radix p. Output k + q m only depends on the entries
+    // k + r m of the sub-transforms, so they can be combined in place.
+    int N = params.jmax;
+    for (int k = 0; k < m; ++k) {
+        for (int r = 0; r < p; ++r) s[r] = out[r * m + k];
+        for (int q = 0; q < p; ++q) {
+            complex_t sum = s[0];
+            for (int r = 1; r < p; ++r) {
+                sum += roots[(long)r * (k + q * m) % n * wstride % N] * s[r];
+            }
+            out[k + q * m] = sum;
+        }
+    }
+}
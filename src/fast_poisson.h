@@ -0,0 +1,61 @@
+#ifndef FAST_POISSON_H3VX9Q2L
+#define FAST_POISSON_H3VX9Q2L
+
+#include "field2d.h"
+#include <complex>
+#include <vector>
+
+// forward declaration
+class Parameters;
+
+/**
+ * Direct solver for the pressure Poisson equation on a domain without
+ * obstacles.
+ *
+ * Top and bottom are always Neumann for the pressure, so the equation is
+ * diagonalised in y direction by a DCT-II of every column. That leaves one
+ * tridiagonal system in x direction per cosine mode, where the left and right
+ * walls may each be Neumann or Dirichlet. The transforms are done with an
+ * in-tree mixed radix FFT of length jmax, the whole solve takes
+ * O(imax jmax log jmax) operations.
+ *
+ * With Neumann conditions all around, the mean of RS is removed first: it
+ * can't be matched by any pressure. The mean of P is then set to zero by
+ * the constant mode of the solution.
+ *
+ * solve() may be called in place of the SOR loop and leaves the ghost values
+ * of P set just like sor() does.
+ */
+class FastPoisson {
+    public:
+        FastPoisson (Parameters const &params);
+
+        // True if the geometry has no obstacle cells
+        static bool applicable (Parameters const &params, Field2D<int> const &Flag);
+
+        // Solve for P, store the RMS residual in res and return the number
+        // of iterations: 1, or 0 if P already was a solution. psum, if
+        // given, receives the sum of P, 0 if the mean was removed already.
+        unsigned int solve (Field2D<double> &P, Field2D<double> &RS, double *res, double *psum = 0);
+
+    private:
+        typedef std::complex<double> complex_t;
+
+        double residual (Field2D<double> &P, Field2D<double> &RS, double mean, double *psum = 0) const;
+
+        // v, V and s are work vectors of length jmax, one set per thread
+        void dct     (double const *x, double *X, std::vector<complex_t> &v, std::vector<complex_t> &V,
+                      std::vector<complex_t> &s) const;
+        void idct    (double const *X, double *x, std::vector<complex_t> &v, std::vector<complex_t> &V,
+                      std::vector<complex_t> &s) const;
+        void fft     (complex_t const *in, complex_t *out, int n, int stride, int wstride, complex_t *s) const;
+
+        Parameters const &params;
+        bool dirichlet_left, dirichlet_right;
+        std::vector<complex_t> roots;    // exp(-2 pi i m / jmax)
+        std::vector<complex_t> shift;    // exp(-pi i k / (2 jmax))
+        Field2D<double> inv_pivot;       // 1 / LU pivot for mode k-1 in column i, [k][i]
+        Field2D<double> W;               // right-hand side and solution in the cosine basis, [i][k]
+};
+
+#endif /* end of include guard: FAST_POISSON_H3VX9Q2L */
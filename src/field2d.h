@@ -0,0 +1,135 @@
+#ifndef FIELD2D_Q8T3ZK5W
+#define FIELD2D_Q8T3ZK5W
+
+#include "helper.h"
+#include <stdlib.h>
+#include <stddef.h>
+#include <algorithm>
+
+/**
+ * Two-dimensional field of cell values, accessed as X[i][j] with
+ * i = 1-ghost .. imax+ghost and j = 1-ghost .. jmax+ghost.
+ *
+ * All values live in a single allocation aligned to 64 bytes. Every row
+ * (fixed i) is contiguous in j and padded to a multiple of 64 bytes, so all
+ * rows start on a cache line. X[i] is computed from the base pointer and the
+ * stride instead of being loaded from an array of row pointers, which lets
+ * the compiler vectorise inner loops over j.
+ *
+ * A field owns its storage and can't be copied. swap() exchanges the storage
+ * of two fields of the same size, e.g. the old and the new temperature.
+ */
+template <typename T> class Field2D {
+    public:
+        static const int alignment = 64;
+
+        Field2D ()
+            : storage(0), origin(0), imax_(0), jmax_(0), ghost_(0), stride_(0)
+        {}
+
+        Field2D (int imax, int jmax, int ghost = 1)
+            : storage(0), origin(0)
+        {
+            allocate(imax, jmax, ghost);
+        }
+
+        Field2D (Field2D &&other)
+            : storage(0), origin(0), imax_(0), jmax_(0), ghost_(0), stride_(0)
+        {
+            swap(other);
+        }
+
+        ~Field2D ()
+        {
+            free(storage);
+        }
+
+        // (Re)allocate the storage, all values including the ghost layers
+        // and the padding are set to zero
+        void allocate (int imax, int jmax, int ghost = 1)
+        {
+            free(storage);
+
+            int per_line = alignment / sizeof(T);
+            imax_   = imax;
+            jmax_   = jmax;
+            ghost_  = ghost;
+            stride_ = (jmax + 2 * ghost + per_line - 1) / per_line * per_line;
+
+            void *p = 0;
+            if (posix_memalign(&p, alignment, size() * sizeof(T)) != 0) {
+                ERROR("Storage cannot be allocated");
+            }
+            storage = static_cast<T*>(p);
+            origin  = storage + (ptrdiff_t)(ghost - 1) * stride_ + (ghost - 1);
+
+            fill(T());
+        }
+
+        T *operator[] (int i)
+        {
+            return origin + (ptrdiff_t)i * stride_;
+        }
+
+        T const *operator[] (int i) const
+        {
+            return origin + (ptrdiff_t)i * stride_;
+        }
+
+        // Set all values, including the ghost layers. The rows are split
+        // among the threads like in the kernels, so that on first touch
+        // each page ends up on the NUMA node of the thread that uses it
+        void fill (T value)
+        {
+            int rows = imax_ + 2 * ghost_;
+            #pragma omp parallel for schedule(static)
+            for (int r = 0; r < rows; ++r) {
+                std::fill(storage + (size_t)r * stride_, storage + (size_t)(r + 1) * stride_, value);
+            }
+        }
+
+        // Copy all values of other, reallocating if the sizes differ
+        void assign (Field2D const &other)
+        {
+            if (imax_ != other.imax_ || jmax_ != other.jmax_ || ghost_ != other.ghost_) {
+                allocate(other.imax_, other.jmax_, other.ghost_);
+            }
+            std::copy(other.storage, other.storage + size(), storage);
+        }
+
+        void swap (Field2D &other)
+        {
+            std::swap(storage, other.storage);
+            std::swap(origin,  other.origin);
+            std::swap(imax_,   other.imax_);
+            std::swap(jmax_,   other.jmax_);
+            std::swap(ghost_,  other.ghost_);
+            std::swap(stride_, other.stride_);
+        }
+
+        int imax   () const { return imax_; }
+        int jmax   () const { return jmax_; }
+        int ghost  () const { return ghost_; }
+        int stride () const { return stride_; }
+
+        // The whole allocation, including the ghost layers and the padding,
+        // e.g. to store it with a single write
+        T       *data ()       { return storage; }
+        T const *data () const { return storage; }
+
+        size_t size () const
+        {
+            return (size_t)(imax_ + 2 * ghost_) * stride_;
+        }
+
+    private:
+        T *storage;    // start of the allocation
+        T *origin;     // address of X[0][0], possibly outside the allocation
+        int imax_, jmax_, ghost_, stride_;
+
+        // copying would share the storage
+        Field2D (Field2D const &);
+        Field2D &operator= (Field2D const &);
+};
+
+#endif /* end of include guard: FIELD2D_Q8T3ZK5W */
@@ -14,15 +14,13 @@ void init_matrices(
   double PI,
   int imax,
   int jmax,
-  double **U,
-  double **V,
-  double **P
+  Field2D<double> &U,
+  Field2D<double> &V,
+  Field2D<double> &P
 ) {
-    for (int i = 0; i <= (imax + 1)*(jmax + 1); ++i) {
-        *(*U + i) = UI;
-        *(*V + i) = VI;
-        *(*P + i) = PI;
-    }
+    U.fill(UI);
+    V.fill(VI);
+    P.fill(PI);
 }
 
 int is_forbidden_cell(int cell) {
@@ -35,7 +33,7 @@ int is_forbidden_cell(int cell) {
     }
 }
 
-int** init_flag(const char* pgm_file, int *imax, int *jmax) {
+Field2D<int> init_flag(const char* pgm_file, int *imax, int *jmax, CellLists *cells) {
     int threshold = 100; // threshold grey value for pic, above we have a solid
     int **pic = NULL;
     // read pgm file
@@ -50,7 +48,7 @@ int** init_flag(const char* pgm_file, int *imax, int *jmax) {
     // with the new design it here is finally possible to allocate storage for
     // the Flag field array
     // Flag field containing obstacle information
-    int** Flag = matrix<int>(0, *imax + 1, 0, *jmax + 1);
+    Field2D<int> Flag(*imax, *jmax);
 
     /* if (size[0] != imax || size[1] != jmax) { */
     /*     ERROR("PGM file dimension does not match imax, jmax dimensions from DAT file."); */
@@ -68,7 +66,7 @@ int** init_flag(const char* pgm_file, int *imax, int *jmax) {
         }
     }
 
-    // loop through pic (w/o boundary layer) and set **Flag field boundary bits
+    // loop through pic (w/o boundary layer) and set Flag field boundary bits
     for (int i = 1; i <= *imax; ++i) {
         for (int j = 1; j <= *jmax; ++j) {
             if (pic[i][j] > threshold)   Flag[i][j] += 16; // cell itself is fluid
@@ -83,16 +81,21 @@ int** init_flag(const char* pgm_file, int *imax, int *jmax) {
             }
         }
     }
+
+    free_matrix<int>(pic, 0, *imax + 2, 0, *jmax + 2);
+
+    cells->build(Flag);
+
     return Flag;
 }
 
-double **init (double const &value, std::string const &file, double const &file_coeff, const int dimx, const int dimy)
+Field2D<double> init (double const &value, std::string const &file, double const &file_coeff, const int dimx, const int dimy)
 {
-    double **m = 0;
+    Field2D<double> m(dimx, dimy);
     if (value < 0) {
         // no valid init_value, hence read the initial concentration from a pgm file.
         int size[2];
-        m = read_pgm <double> (file.c_str(), size);
+        double **pic = read_pgm <double> (file.c_str(), size);
         if ((size[0] != dimx) || (size[1] != dimy)) {
             std::string err_msg = "File " +  file + " dimensions " + std::to_string(size[0]) + "x" + std::to_string(size[1]) +
                 " don't match those configured " + std::to_string(dimx) + "x" + std::to_string(dimy);
@@ -100,12 +103,16 @@ double **init (double const &value, std::string const &file, double const &file_
         }
 
         // since the value range is [0..255], we have to do some scaling
-        for (int i = 0; i < (dimx + 1)*(dimy+1); ++i) *(*m + i) *= file_coeff;
+        for (int i = 0; i <= dimx + 1; ++i) {
+            for (int j = 0; j <= dimy + 1; ++j) {
+                m[i][j] = pic[i][j] * file_coeff;
+            }
+        }
+        free_matrix <double> (pic, 0, dimx + 2, 0, dimy + 2);
     }
     else {
         // initialize matrix, using init_value
-        m = matrix <double> (0, dimx+1, 0, dimy+1);
-        init_matrix (m, 0, dimx+1, 0, dimy+1, value);
+        m.fill(value);
     }
 
     return m;
@@ -1,6 +1,10 @@
 #ifndef __INIT_H_
 #define __INIT_H_
 
+#include "field2d.h"
+#include "cell_lists.h"
+#include <string>
+
 /**
  * The arrays U,V and P are initialized to the constant values UI, VI and PI on
  * the whole domain.
@@ -11,9 +15,9 @@ void init_matrices(
   double PI,
   int imax,
   int jmax,
-  double **U,
-  double **V,
-  double **P
+  Field2D<double> &U,
+  Field2D<double> &V,
+  Field2D<double> &P
 );
 
 /**
@@ -22,15 +26,17 @@ void init_matrices(
 int is_forbidden_cell(int Field);
 
 /**
- * Initialise the **Flag field with the obstacle and fluid cell flags.
- * Returns int** pointer to Flag array.
+ * Initialise the Flag field with the obstacle and fluid cell flags.
+ * Returns the Flag field, imax and jmax are taken from the pgm file.
+ * The lists of fluid and obstacle cells are built from it in cells.
  */
-int** init_flag(
+Field2D<int> init_flag(
   const char* pgm_file,
   int *imax,
-  int *jmax);
+  int *jmax,
+  CellLists *cells);
 
-double **init (double const &value, std::string const &file, double const &file_coeff, const int dimx, const int dimy);
+Field2D<double> init (double const &value, std::string const &file, double const &file_coeff, const int dimx, const int dimy);
 
 #endif
 
@@ -1,18 +1,26 @@
 #include "helper.h"
 #include "matrix.h"
 #include "visual.h"
+#include "output_writer.h"
+#include "checkpoint.h"
+#include "profiler.h"
 #include "init.h"
 #include "uvp.h"
 #include "pgm.h"
 #include "boundary_val.h"
 #include "sor.h"
+#include "multigrid.h"
+#include "pcg.h"
+#include "fast_poisson.h"
 #include "tc.h"
 #include "reaction.h"
+#include "steady_state.h"
+#include "pressure_predictor.h"
 #include <float.h>
 #include <stdio.h>
 #include <string.h>
 #include <iostream>
-#include "Range2.h"
+#include <algorithm>
 #include "Parameters.h"
 
 int main(int argc, char** argv){
@@ -21,9 +29,16 @@ int main(int argc, char** argv){
 
     // Use a parameter file given on the command line or fallback to default
     // note: conf_dir must contain trailing slash
+    // Usage: sim [--restart <checkpoint>] [<parameter file>]
     std::string conf_file = "../conf/wire.xml", conf_dir  = "../conf/";
-    if (argc == 2) {
-        std::string arg(argv[1]);
+    std::string restart_file;
+    int argi = 1;
+    if (argi + 1 < argc && std::string(argv[argi]) == "--restart") {
+        restart_file = argv[argi + 1];
+        argi += 2;
+    }
+    if (argi < argc) {
+        std::string arg(argv[argi]);
         // c++ only way in order to avoid using boost::filesystem
         auto pivot = std::find   (arg.rbegin(), arg.rend(), '/' ).base();
         conf_file  = std::string (pivot, arg.end());
@@ -40,154 +55,397 @@ int main(int argc, char** argv){
 
     // read from pgm file. the init_flag function also allocates storage
     // for the Flag field, since only that way we git rid of the imax and jmax
-    // in the .dat file.
-    int **Flag = init_flag((conf_dir + params.geometry_file).c_str(), &(params.imax), &(params.jmax) );
-
-    Range2 idx_range(1, params.imax, 1, params.jmax);
+    // in the .dat file. The kernels loop over the cell lists built from it.
+    CellLists cells;
+    Field2D<int> Flag = init_flag((conf_dir + params.geometry_file).c_str(), &(params.imax), &(params.jmax), &cells);
 
     params.dx = params.xlength / params.imax;
     params.dy = params.ylength / params.jmax;
 
     // allocate storage for all matrices according to the parameters just read
-    double **U = matrix<double>(0, params.imax + 1, 0, params.jmax +1);
-    double **V = matrix<double>(0, params.imax + 1, 0, params.jmax +1);
-    double **P = matrix<double>(0, params.imax + 1, 0, params.jmax +1);
-    // Indexes to kmax and not kmax + 1 because those values are not used.
-    double **F = matrix<double>(0, params.imax, 0, params.jmax);
-    double **G = matrix<double>(0, params.imax, 0, params.jmax);
-    double **RS = matrix<double>(0, params.imax, 0, params.jmax);
-
-    // Concentration matrix: array of pointers to matrices of substances
-    // and concentration matrix to swap
-    double ***C = new double**[params.nof_substances()];
+    Field2D<double> U (params.imax, params.jmax);
+    Field2D<double> V (params.imax, params.jmax);
+    Field2D<double> P (params.imax, params.jmax);
+    Field2D<double> F (params.imax, params.jmax);
+    Field2D<double> G (params.imax, params.jmax);
+    Field2D<double> RS(params.imax, params.jmax);
+
+    // Concentration matrices, one for each substance
+    std::vector<Field2D<double> > C;
+    C.reserve(params.nof_substances());
 
     for (unsigned int s = 0; s < params.nof_substances(); ++s) {
         // allocate and initialize a matrix for the concentration of the s'th substance
-        C[s] = init (params.substance[s].init_value, conf_dir + params.substance[s].init_file, params.substance[s].init_file_coeff, params.imax, params.jmax);
-
-        // allocate a matrix for swapping the concentration
+        C.push_back(init (params.substance[s].init_value, conf_dir + params.substance[s].init_file, params.substance[s].init_file_coeff, params.imax, params.jmax));
     }
 
-    // Swap matrix for computation of explicit quantities
-    double **swap = matrix<double>(0, params.imax + 1, 0, params.jmax +1);
+    // Swap matrices for computation of explicit quantities, one for every
+    // substance and one for the temperature
+    std::vector<Field2D<double> > swap;
+    swap.reserve(params.nof_substances() + 1);
+    for (unsigned int s = 0; s <= params.nof_substances(); ++s) {
+        swap.push_back(Field2D<double>(params.imax, params.jmax));
+    }
 
     // temperature
-    double **T = init (params.TI, params.TI_file, params.TI_file_coeff, params.imax, params.jmax);
+    Field2D<double> T = init (params.TI, params.TI_file, params.TI_file_coeff, params.imax, params.jmax);
+
+    // Coarse grid hierarchy, only needed by the multigrid solver
+    Multigrid *multigrid = 0;
+    if (params.solver == SOLVER_MULTIGRID) {
+        multigrid = new Multigrid(params, Flag, cells);
+        std::cout << "Multigrid with " << multigrid->nof_levels() << " levels" << std::endl;
+    }
+
+    // Work vectors and preconditioner, only needed by the CG solver
+    Pcg *pcg = 0;
+    if (params.solver == SOLVER_PCG) {
+        pcg = new Pcg(params, Flag, cells);
+    }
+
+    // Transforms and LU decompositions for the direct solver, which can't
+    // deal with obstacles
+    FastPoisson *fast_poisson = 0;
+    if (params.solver == SOLVER_FFT) {
+        if (FastPoisson::applicable(params, Flag)) {
+            fast_poisson = new FastPoisson(params);
+        }
+        else {
+            std::cout << "Geometry has obstacles, falling back to SOR" << std::endl;
+            params.solver = SOLVER_SOR;
+        }
+    }
+    bool fft_warned = false;
 
     // Assign initial values to u, v, p
     init_matrices(params.UI, params.VI, params.PI, params.imax, params.jmax, U, V, P);
 
-    // A vector to accumulate the rates for each substance seems adequate.
-    // Change if there's a prettier solution
-    std::vector<double> rates;
-    rates.resize(params.nof_substances());
+    // Last sub-step size of every cell, only needed by the implicit chemistry
+    Field2D<double> H_chem;
+    chemistry_stats_t chemistry_stats = { 0, 0 };
+    if (params.chemistry == CHEMISTRY_ROSENBROCK) {
+        H_chem.allocate(params.imax, params.jmax);
+    }
+
+    // Initial guess of the pressure solver from the last solutions
+    PressurePredictor predictor(params, cells);
+
+    // Relaxation factor of the SOR solvers, fixed or adapted during the run
+    OmegaTuner omega(params.omg, params.omg_auto, params.omg_max);
+
+    // Stops the run once it is steady or periodic
+    SteadyStateMonitor monitor(params, cells, Flag);
+
+    // Everything the time loop carries from one step to the next. swap, F,
+    // G and RS are included for their boundary values.
+    std::vector<Field2D<double> *> state_fields = { &U, &V, &P, &T, &F, &G, &RS };
+    for (unsigned int s = 0; s < C.size(); ++s) state_fields.push_back(&C[s]);
+    for (unsigned int s = 0; s < swap.size(); ++s) state_fields.push_back(&swap[s]);
+    if (params.chemistry == CHEMISTRY_ROSENBROCK) state_fields.push_back(&H_chem);
+    std::vector<Field2D<double> *> history = predictor.fields();
+    state_fields.insert(state_fields.end(), history.begin(), history.end());
+    std::vector<Field2D<double> *> watched = monitor.fields();
+    state_fields.insert(state_fields.end(), watched.begin(), watched.end());
+
+    loop_state_t state;
+    state.t  = 0;
+    state.dt = params.dt;
+    state.n  = 0;
+    state.omg = omega.omega();
+    state.omega = omega.state();
+    state.next_printing_time   = 0;
+    state.next_checkpoint_time = params.checkpoint_dt;
+
+    if (!restart_file.empty()) {
+        std::cout << "Restarting from checkpoint " << restart_file << std::endl;
+        read_checkpoint(restart_file, params, state, state_fields);
+        omega.set_omega(state.omg);
+        omega.restore(state.omega);
+        monitor.restore(state.monitor);
+    }
+
+    // Reaction rate of every substance, computed once per time step for both
+    // the time step size and the reaction itself
+    std::vector<Field2D<double> > R;
+    R.reserve(params.nof_substances());
+    for (unsigned int s = 0; s < params.nof_substances(); ++s) {
+        R.push_back(Field2D<double>(params.imax, params.jmax));
+    }
+    unsigned long rate_evaluations = 0, dt_steps = 0;
+
+    // Sweeps of calculate_next_scalars, more than one per time step with
+    // sub-cycling
+    unsigned long transport_sweeps = 0;
+
+    // Iterations of the pressure solver, to compare initial guesses
+    unsigned long pressure_iterations = 0, pressure_solves = 0, predictions = 0;
+
+    // The reactions, compiled for the rate evaluation
+    ReactionNetwork network(params);
+
+    // VTK files are written in the background while the time loop goes on
+    OutputWriter output(params);
+
+    // Time spent in each phase of the time loop
+    Profiler profiler(params, cells);
 
     std::cout << "Starting simulation..." << std::endl;
 
-    double t = 0;
-    unsigned int n = 0;
+    double t = state.t;
+    unsigned int n = state.n;
+    dt = state.dt;
 
     /* A couple of numbers to control the progress feedback of the program */
-    double next_printing_time = 0;
+    double next_printing_time = state.next_printing_time;
+    double next_checkpoint_time = state.next_checkpoint_time;
+
+    while (t < params.t_end && (params.max_steps == 0 || n < params.max_steps)) {
+        profiler.begin_step();
 
-    while (t < params.t_end) {
+        // Size of the previous time step, for the pressure predictor
+        double dt_prev = dt;
 
         if (t >= next_printing_time){
+            ScopedTimer timer(profiler, PHASE_OUTPUT);
             printf("Currently at t = %f. Printing VTK\n",t);
-            write_vtkFile(params.out_prefix, n, params, U, V, P, T, C);
+            output.write(n, U, V, P, T, C);
             next_printing_time += params.out_dt;
         }
 
+        if (params.checkpoint_dt > 0 && t >= next_checkpoint_time) {
+            ScopedTimer timer(profiler, PHASE_CHECKPOINT);
+            next_checkpoint_time += params.checkpoint_dt;
+            printf("Currently at t = %f. Writing checkpoint\n", t);
+
+            state.t  = t;
+            state.dt = dt;
+            state.n  = n;
+            state.omg = omega.omega();
+            state.omega = omega.state();
+            state.monitor = monitor.state();
+            state.next_printing_time   = next_printing_time;
+            state.next_checkpoint_time = next_checkpoint_time;
+            write_checkpoint(params.checkpoint_file, params, state,
+                             std::vector<Field2D<double> const *>(state_fields.begin(), state_fields.end()));
+        }
+
         // Set boundary values for u and v
-        domain_boundary_values(params, U, V, T, C);
-        inner_boundary_values(params.imax, params.jmax, U, V, P, F, G, Flag);
-        spec_boundary_val(params.problem.c_str(), params, U, V, C);
+        {
+            ScopedTimer timer(profiler, PHASE_BOUNDARY);
+            domain_boundary_values(params, U, V, T, C);
+            inner_boundary_values(params.imax, params.jmax, U, V, P, F, G, cells);
+            spec_boundary_val(params.problem.c_str(), params, U, V, C);
+        }
+
+        // Reaction rates for the current concentrations and temperature,
+        // the implicit chemistry evaluates its own
+        if (params.chemistry == CHEMISTRY_EULER) {
+            ScopedTimer timer(profiler, PHASE_RATES);
+            clamp_concentrations(C, cells);
+            network.rates(C, T, cells, R);
+            rate_evaluations++;
+        }
 
         // Select dt according to (13)
         // The requirement of not changing the framework, forces us to make this decision here
         if ( params.tau > 0 ){
-            calculate_dt(params, &dt, U, V, T, C, Flag, rates);
+            ScopedTimer timer(profiler, PHASE_DT);
+            calculate_dt(params, &dt, U, V, C, R, cells);
+            dt_steps++;
         }
 
         // Compute reaction effects
-        compute_reaction ( C, T, Flag, dt, params, rates );
-
-        // Compute concentration of all substances
-        calculate_next_C (idx_range, U, V, C, &swap, Flag, params, dt);
+        {
+            ScopedTimer timer(profiler, PHASE_REACTION);
+            if (params.chemistry == CHEMISTRY_ROSENBROCK) {
+                clamp_concentrations(C, cells);
+                chemistry_stats_t stats = network.integrate(C, T, cells, dt, H_chem);
+                chemistry_stats.accepted += stats.accepted;
+                chemistry_stats.rejected += stats.rejected;
+            }
+            else {
+                compute_reaction ( C, T, cells, dt, params, R );
+            }
+        }
 
         // TODO calculate reaction rate R
 
-        // Compute temperature
-        calculate_next_T (idx_range, U, V, &T, &swap, Flag, params, dt);
+        // Compute concentration of all substances and temperature
+        {
+            ScopedTimer timer(profiler, PHASE_TRANSPORT);
+            if (params.transport_subcycles > 1) {
+                // The velocities stay frozen, every scalar takes as many steps
+                // of its own as its stability condition requires. Its
+                // boundary values are set again between the steps
+                std::vector<unsigned int> steps = scalar_substeps(params, dt);
+                unsigned int nsteps = *std::max_element(steps.begin(), steps.end());
+                std::vector<double> dts(steps.size());
+                for (unsigned int m = 0; m < nsteps; ++m) {
+                    if (m > 0) {
+                        domain_boundary_values(params, U, V, T, C);
+                        spec_boundary_val(params.problem.c_str(), params, U, V, C);
+                    }
+                    for (size_t k = 0; k < steps.size(); ++k) {
+                        dts[k] = (m < steps[k]) ? dt / steps[k] : 0;
+                    }
+                    calculate_next_scalars (cells, U, V, &T, C, swap, Flag, params, dts);
+                }
+                transport_sweeps += nsteps;
+            }
+            else {
+                calculate_next_scalars (cells, U, V, &T, C, swap, Flag, params, dt);
+                transport_sweeps++;
+            }
+        }
 
-        // Compute F (n) and G(n) according to (9),(10),(17)
-        calculate_fg(params, U, V, T, F, G, Flag, dt);
+        if (params.rhs == RHS_FUSED) {
+            // F, G and rs below in one pass over the rows
+            ScopedTimer timer(profiler, PHASE_FG_RS);
+            calculate_fg_rs(params, U, V, T, F, G, RS, cells, dt);
+        }
+        else {
+            // Compute F (n) and G(n) according to (9),(10),(17)
+            {
+                ScopedTimer timer(profiler, PHASE_FG);
+                calculate_fg(params, U, V, T, F, G, cells, dt);
+            }
 
-        // Compute the right-hand side rs of the pressure equation (11)
-        calculate_rs(dt, params.dx, params.dy, params.imax, params.jmax, F, G, RS, Flag);
+            // Compute the right-hand side rs of the pressure equation (11)
+            {
+                ScopedTimer timer(profiler, PHASE_RS);
+                calculate_rs(dt, params.dx, params.dy, params.imax, params.jmax, F, G, RS, cells);
+            }
+        }
 
         unsigned int it = 0;
         double res = DBL_MAX;
 
-        while ((it < params.itermax) && (res > params.eps)) {
-            // Perform a SOR iteration according to (18) using the provided function and retrieve the residual res
-            sor(params.omg, params.dx, params.dy, params.imax, params.jmax, P, RS, &res, Flag, params.wlvp, params.wrvp, params.wtvp, params.wbvp, params.pl, params.pr, params.pt, params.pb);
-            ++it;
+        // Every solver hands out the sum of P from its last pass over it:
+        // the SOR solvers sum up P during every sweep the residual is
+        // checked after, i.e. also during the last one. pcg and fft remove
+        // the mean themselves where a constant is free, their sum is 0 then
+        double p_sum = 0;
+
+        if (params.predictor != PREDICTOR_NONE) {
+            ScopedTimer timer(profiler, PHASE_NORMALIZE);
+            if (predictor.predict(P, dt, dt_prev, n)) predictions++;
         }
-        printf("dt: %f, current t: %f, SOR iterations: %d\n",dt,t, it);
 
-        /* Keep the average of the pressure at zero */
         {
-            double average;
-            int i, j, counter=0;
-            for ( i = 0 ; i <= params.imax + 1; i++){
-                for ( j = 0; j <= params.jmax + 1; j++ ){
-                    if( Flag[i][j] & 16 ){
-                        average += P[i][j];
-                        counter++;
-                    }
+            ScopedTimer timer(profiler, PHASE_PRESSURE);
+
+            // CG keeps its search direction from one iteration to the next and
+            // thus runs its own loop, the direct solver needs no loop at all
+            if (params.solver == SOLVER_PCG) {
+                it = pcg->solve(P, RS, &res, &p_sum);
+            }
+            else if (params.solver == SOLVER_FFT) {
+                it = fast_poisson->solve(P, RS, &res, &p_sum);
+
+                // Only round-off is left after the direct solve. Anything
+                // above eps is refined by the SOR loop below
+                if (res > params.eps && !fft_warned) {
+                    printf("Warning: direct solver left a residual of %g > eps = %g, continuing with SOR\n",
+                           res, params.eps);
+                    fft_warned = true;
                 }
             }
-            average /= counter;
-            for ( i = 0 ; i <= params.imax + 1; i++){
-                for ( j = 0; j <= params.jmax + 1; j++ ){
-                    if( Flag[i][j] & 16 ){
-                        P[i][j] -= average;
-                    }
+
+            while ((it < params.itermax) && (res > params.eps)) {
+                ++it;
+
+                // The residual is only needed every residual_interval SOR
+                // iterations and after the last one
+                bool check = (it % params.residual_interval == 0) || (it == params.itermax);
+                int residual_mode = check ? params.residual_mode : SOR_RESIDUAL_SKIP;
+                double *sum = check ? &p_sum : 0;
+
+                // Perform a SOR iteration according to (18) using the provided function and retrieve the residual res
+                if (params.solver == SOLVER_MULTIGRID) {
+                    multigrid->cycle(P, RS, &res, &p_sum);
+                }
+                else if (params.sor_ordering == SOR_RED_BLACK) {
+                    sor_redblack(omega.omega(), params.dx, params.dy, params.imax, params.jmax, P, RS, &res, cells, params.wlvp, params.wrvp, params.wtvp, params.wbvp, params.pl, params.pr, params.pt, params.pb, residual_mode, sum);
+                    if (check) omega.residual(res, it);
+                }
+                else {
+                    sor(omega.omega(), params.dx, params.dy, params.imax, params.jmax, P, RS, &res, cells, params.wlvp, params.wrvp, params.wtvp, params.wbvp, params.pl, params.pr, params.pt, params.pb, residual_mode, sum);
+                    if (check) omega.residual(res, it);
                 }
             }
+            omega.end_solve(res <= params.eps, it);
+            timer.repeat(it);
+        }
+        printf("dt: %f, current t: %f, SOR iterations: %d\n",dt,t, it);
+        pressure_iterations += it;
+        pressure_solves++;
+
+        /* Keep the average of the pressure at zero */
+        {
+            ScopedTimer timer(profiler, PHASE_NORMALIZE);
+            predictor.update(P, p_sum / cells.nof_fluid, dt, dt_prev, n);
         }
 
         // Compute u(n+1) and v (n+1) according to (7),(8)
-        calculate_uv(dt, params.dx, params.dy, params.imax, params.jmax, U, V, F, G, P, Flag);
+        {
+            ScopedTimer timer(profiler, PHASE_UV);
+            calculate_uv(dt, params.dx, params.dy, params.imax, params.jmax, U, V, F, G, P, cells);
+        }
 
+        bool settled;
+        {
+            ScopedTimer timer(profiler, PHASE_MONITOR);
+            settled = monitor.update(t + dt, U, V, P, T, C);
+        }
 
+        profiler.end_step(n, t, dt, it);
 
         t += dt;
         ++n;
+
+        if (settled) {
+            printf("Currently at t = %f. The run is %s, stopping\n", t, monitor.reason());
+            break;
+        }
     }
 
-    write_vtkFile(params.out_prefix, n, params, U, V, P, T, C);
+    {
+        ScopedTimer timer(profiler, PHASE_OUTPUT);
+        output.write(n, U, V, P, T, C);
+        output.finish();
+    }
 
+    profiler.print_summary(stdout);
 
-    // deallocate the storage of all matrices
-    free_matrix <double> (U,    0, params.imax + 1, 0, params.jmax +1);
-    free_matrix <double> (V,    0, params.imax + 1, 0, params.jmax +1);
-    free_matrix <double> (P,    0, params.imax + 1, 0, params.jmax +1);
-    free_matrix <double> (F,    0, params.imax,     0, params.jmax);
-    free_matrix <double> (G,    0, params.imax,     0, params.jmax);
-    free_matrix <double> (RS,   0, params.imax,     0, params.jmax);
-    free_matrix <int>    (Flag, 0, params.imax + 1, 0, params.jmax + 1);
-    free_matrix <double> (swap, 0, params.imax + 1, 0, params.jmax + 1);
-    free_matrix <double> (T,    0, params.imax,     0, params.jmax);
+    printf("\nPressure: %lu iterations, %.2f per time step, %lu started from a prediction\n",
+           pressure_iterations, pressure_solves > 0 ? (double)pressure_iterations / pressure_solves : 0.0,
+           predictions);
+    if (params.omg_auto) {
+        printf("SOR: omega = %.4f after %u adjustments\n", omega.omega(), omega.updates());
+    }
 
-    // free concentration matrices
-    // we can't simply call delete[][][], since the inner matrix was allocated
-    // using malloc
-    for (unsigned int i = 0; i < params.substance.size(); ++i) {
-        free_matrix <double> (C[i], 0, params.imax + 1, 0, params.jmax + 1);
+    if (params.transport_subcycles > 1) {
+        printf("\nTransport: %lu sweeps in %u time steps, %.3g pressure solves per unit time\n",
+               transport_sweeps, n, t > 0 ? n / t : 0.0);
     }
-    delete[] C;
+
+    if (params.chemistry == CHEMISTRY_ROSENBROCK) {
+        printf("\nChemistry: %lu sub-steps, %lu rejected, %.2f per cell and time step\n",
+               chemistry_stats.accepted, chemistry_stats.rejected,
+               n > 0 ? (double)chemistry_stats.accepted / ((double)n * cells.nof_fluid) : 0.0);
+    }
+    else if (!params.reactions.empty()) {
+        // Without the cached rates, calculate_dt and compute_reaction would
+        // both evaluate them
+        double per_sweep = (double)cells.nof_fluid * network.transcendentals_per_cell();
+        printf("\nReaction rates: %.3g pow/exp calls, %.3g saved by reusing the rates of the time step\n",
+               rate_evaluations * per_sweep, dt_steps * per_sweep);
+    }
+
+
+    delete multigrid;
+    delete pcg;
+    delete fast_poisson;
 
     return 0;
 }
@@ -0,0 +1,300 @@
+#include "multigrid.h"
+#include "Parameters.h"
+#include "boundary_conditions.h"
+#include "sor.h"
+#include <algorithm>
+
+
+// Off-diagonal sum and diagonal of the 5-point stencil at cell (i,j), on any
+// level. Fluid neighbours couple, obstacles and Neumann walls drop out, and
+// behind a Dirichlet wall the ghost value is 2*p_wall - E[i][j].
+static inline void stencil(
+        Field2D<int> const &fluid, Field2D<double> const &E, int i, int j, int imax,
+        double idx2, double idy2, bool dirichlet_left, bool dirichlet_right,
+        double pl, double pr, double &off, double &diag)
+{
+    off  = 0;
+    diag = 0;
+
+    if (fluid[i-1][j]) { off += idx2 * E[i-1][j]; diag += idx2; }
+    else if (i == 1 && dirichlet_left) { off += 2 * idx2 * pl; diag += 2 * idx2; }
+
+    if (fluid[i+1][j]) { off += idx2 * E[i+1][j]; diag += idx2; }
+    else if (i == imax && dirichlet_right) { off += 2 * idx2 * pr; diag += 2 * idx2; }
+
+    // Top and bottom are always Neumann for the pressure, see sor()
+    if (fluid[i][j-1]) { off += idy2 * E[i][j-1]; diag += idy2; }
+    if (fluid[i][j+1]) { off += idy2 * E[i][j+1]; diag += idy2; }
+}
+
+
+Multigrid::Multigrid (Parameters const &params, Field2D<int> const &Flag, CellLists const &cells)
+    : params(params), cells(cells),
+      dirichlet_left (params.wlvp == BC_PRESSURE),
+      dirichlet_right(params.wrvp == BC_PRESSURE)
+{
+    level_t fine = {};
+    fine.imax  = params.imax;
+    fine.jmax  = params.jmax;
+    fine.dx    = params.dx;
+    fine.dy    = params.dy;
+    fine.cx    = 1;
+    fine.cy    = 1;
+    fine.pl    = params.pl;
+    fine.pr    = params.pr;
+    fine.fluid.allocate(fine.imax, fine.jmax);
+    fine.R.allocate    (fine.imax, fine.jmax);
+    fine.T.allocate    (fine.imax, fine.jmax);
+    for (int i = 0; i <= fine.imax + 1; ++i) {
+        for (int j = 0; j <= fine.jmax + 1; ++j) {
+            fine.fluid[i][j] = (Flag[i][j] & 16) ? 1 : 0;
+        }
+    }
+    levels.push_back(std::move(fine));
+
+    // Merge cells until the grid can't be halved anymore. Only the direction
+    // with the smaller mesh width is coarsened while the cells are stretched
+    // by more than a factor 1.5. An odd number of cells is merged with a
+    // last coarse cell of only one child, which is fine next to a Neumann
+    // wall but would move a Dirichlet wall.
+    while (params.mg_levels == 0 || levels.size() < params.mg_levels) {
+        level_t const &f = levels.back();
+        level_t c = {};
+
+        bool even_x = (f.imax % 2 == 0) || !(dirichlet_left || dirichlet_right);
+        c.cx = (f.imax >= 2 && even_x && f.dx < 1.5 * f.dy) ? 2 : 1;
+        c.cy = (f.jmax >= 2           && f.dy < 1.5 * f.dx) ? 2 : 1;
+        if (c.cx == 1 && c.cy == 1) break;
+
+        c.imax  = (f.imax + c.cx - 1) / c.cx;
+        c.jmax  = (f.jmax + c.cy - 1) / c.cy;
+        c.dx    = c.cx * f.dx;
+        c.dy    = c.cy * f.dy;
+        c.fluid.allocate(c.imax, c.jmax);
+        c.error.allocate(c.imax, c.jmax);
+        c.R.allocate    (c.imax, c.jmax);
+        c.T.allocate    (c.imax, c.jmax);
+
+        for (int i = 1; i <= f.imax; ++i) {
+            for (int j = 1; j <= f.jmax; ++j) {
+                if (f.fluid[i][j]) c.fluid[(i + c.cx - 1) / c.cx][(j + c.cy - 1) / c.cy] = 1;
+            }
+        }
+
+        levels.push_back(std::move(c));
+    }
+
+    // only now the levels have their final address
+    for (unsigned int l = 1; l < levels.size(); ++l) {
+        levels[l].E = &levels[l].error;
+    }
+}
+
+
+unsigned int Multigrid::nof_levels () const
+{
+    return levels.size();
+}
+
+
+void Multigrid::cycle (Field2D<double> &P, Field2D<double> &RS, double *res, double *psum)
+{
+    level_t &fine = levels[0];
+    fine.E = &P;
+
+    // Copy the right-hand side. Without any Dirichlet wall only its part
+    // with zero mean can be matched, the rest would keep the residual from
+    // ever dropping below eps.
+    double sum = 0;
+    int counter = 0;
+    #pragma omp parallel for reduction(+:sum,counter)
+    for (int i = 1; i <= fine.imax; ++i) {
+        for (int j = 1; j <= fine.jmax; ++j) {
+            if (fine.fluid[i][j]) {
+                fine.R[i][j] = RS[i][j];
+                sum += RS[i][j];
+                counter++;
+            }
+        }
+    }
+    if (!dirichlet_left && !dirichlet_right) {
+        double mean = sum / counter;
+        #pragma omp parallel for
+        for (int i = 1; i <= fine.imax; ++i) {
+            for (int j = 1; j <= fine.jmax; ++j) {
+                if (fine.fluid[i][j]) fine.R[i][j] -= mean;
+            }
+        }
+    }
+
+    cycle_level(0);
+
+    // RMS of the residual over all fluid cells, and the sum of P from the
+    // same pass. Its mean can't be removed there: the residual of a cell
+    // reads its neighbours, which other threads would be shifting
+    double rloc;
+    residual(fine, &rloc, psum);
+    *res = sqrt(rloc / counter);
+
+    // obstacle and ghost values for the rest of the time step
+    sor_obstacle_boundaries(P, cells);
+    sor_domain_boundaries(params.imax, params.jmax, P, params.wlvp, params.wrvp, params.wtvp, params.wbvp, params.pl, params.pr, params.pt, params.pb);
+}
+
+
+void Multigrid::cycle_level (unsigned int l)
+{
+    level_t &lv = levels[l];
+
+    // Coarsest level: just smooth until the few unknowns are converged
+    if (l + 1 == levels.size()) {
+        smooth(lv, 2 * (lv.imax + lv.jmax));
+        return;
+    }
+
+    smooth(lv, params.mg_pre_smooth);
+    residual(lv);
+    restrict_to(lv, levels[l + 1]);
+    for (int g = 0; g < params.mg_cycle; ++g) cycle_level(l + 1);
+    prolongate(levels[l + 1], lv);
+    smooth(lv, params.mg_post_smooth);
+}
+
+
+void Multigrid::smooth (level_t &lv, unsigned int sweeps)
+{
+    Field2D<double> &E = *lv.E;
+    double idx2 = 1 / (lv.dx * lv.dx), idy2 = 1 / (lv.dy * lv.dy);
+
+    for (unsigned int s = 0; s < sweeps; ++s) {
+        for (int colour = 0; colour <= 1; colour++) {
+            #pragma omp parallel for
+            for (int i = 1; i <= lv.imax; ++i) {
+                for (int j = 2 - ((i + colour) & 1); j <= lv.jmax; j += 2) {
+                    if (!lv.fluid[i][j]) continue;
+
+                    double off, diag;
+                    stencil(lv.fluid, E, i, j, lv.imax, idx2, idy2, dirichlet_left, dirichlet_right, lv.pl, lv.pr, off, diag);
+
+                    // isolated cells have no equation
+                    if (diag > 0) E[i][j] = (off - lv.R[i][j]) / diag;
+                }
+            }
+        }
+    }
+}
+
+
+void Multigrid::residual (level_t &lv, double *rss, double *esum)
+{
+    Field2D<double> const &E = *lv.E;
+    double idx2 = 1 / (lv.dx * lv.dx), idy2 = 1 / (lv.dy * lv.dy);
+
+    double rloc = 0, sum = 0;
+    #pragma omp parallel for reduction(+:rloc,sum)
+    for (int i = 1; i <= lv.imax; ++i) {
+        for (int j = 1; j <= lv.jmax; ++j) {
+            if (lv.fluid[i][j]) {
+                double off, diag;
+                stencil(lv.fluid, E, i, j, lv.imax, idx2, idy2, dirichlet_left, dirichlet_right, lv.pl, lv.pr, off, diag);
+                lv.T[i][j] = lv.R[i][j] - (off - diag * E[i][j]);
+                rloc += lv.T[i][j] * lv.T[i][j];
+                sum  += E[i][j];
+            }
+            else {
+                lv.T[i][j] = 0;
+            }
+        }
+    }
+    if (rss)  *rss  = rloc;
+    if (esum) *esum = sum;
+}
+
+
+// The right-hand side of a coarse cell is the average residual of its fluid
+// children. The initial guess for the coarse error is zero.
+void Multigrid::restrict_to (level_t const &fine, level_t &coarse)
+{
+    double sum = 0;
+    int counter = 0;
+
+    #pragma omp parallel for reduction(+:sum,counter)
+    for (int I = 1; I <= coarse.imax; ++I) {
+        for (int J = 1; J <= coarse.jmax; ++J) {
+            double r = 0;
+            int n = 0;
+            for (int i = coarse.cx * (I-1) + 1; i <= std::min(coarse.cx * I, fine.imax); ++i) {
+                for (int j = coarse.cy * (J-1) + 1; j <= std::min(coarse.cy * J, fine.jmax); ++j) {
+                    if (fine.fluid[i][j]) {
+                        r += fine.T[i][j];
+                        n++;
+                    }
+                }
+            }
+            coarse.R[I][J] = (n > 0) ? r / n : 0;
+            if (n > 0) {
+                sum += coarse.R[I][J];
+                counter++;
+            }
+        }
+    }
+
+    // Without any Dirichlet wall the problem is pure Neumann and only
+    // solvable for a right-hand side with zero mean. Project it out, the
+    // constant part can't be corrected anyway.
+    if (!dirichlet_left && !dirichlet_right && counter > 0) {
+        double mean = sum / counter;
+        #pragma omp parallel for
+        for (int I = 1; I <= coarse.imax; ++I) {
+            for (int J = 1; J <= coarse.jmax; ++J) {
+                if (coarse.fluid[I][J]) coarse.R[I][J] -= mean;
+            }
+        }
+    }
+
+    coarse.E->fill(0);
+}
+
+
+// Bilinear interpolation of the coarse error, added on the fluid cells of the
+// fine level. In a direction which wasn't coarsened the child simply takes
+// the value of its parent. Coarse neighbours which are obstacles or behind a
+// Neumann wall take the value of the parent cell, behind a Dirichlet wall
+// its negative.
+void Multigrid::prolongate (level_t const &coarse, level_t const &fine)
+{
+    // weight of the parent cell, the neighbour gets the rest
+    double wx = (coarse.cx == 2) ? 0.75 : 1.0;
+    double wy = (coarse.cy == 2) ? 0.75 : 1.0;
+
+    Field2D<double> const &Ec = *coarse.E;
+    Field2D<double>       &Ef = *fine.E;
+
+    #pragma omp parallel for
+    for (int i = 1; i <= fine.imax; ++i) {
+        for (int j = 1; j <= fine.jmax; ++j) {
+            if (!fine.fluid[i][j]) continue;
+
+            int I  = (i + coarse.cx - 1) / coarse.cx, J = (j + coarse.cy - 1) / coarse.cy;
+            int Ii = (i & 1) ? I - 1 : I + 1,         Jj = (j & 1) ? J - 1 : J + 1;
+            double e0 = Ec[I][J];
+
+            double ex = e0, ey = e0, exy = e0;
+            if (Ii < 1 || Ii > coarse.imax) {
+                if ((Ii < 1 && dirichlet_left) || (Ii > coarse.imax && dirichlet_right)) ex = -e0;
+            }
+            else if (coarse.fluid[Ii][J]) ex = Ec[Ii][J];
+
+            if (Jj >= 1 && Jj <= coarse.jmax && coarse.fluid[I][Jj]) ey = Ec[I][Jj];
+
+            if (Ii >= 1 && Ii <= coarse.imax && Jj >= 1 && Jj <= coarse.jmax && coarse.fluid[Ii][Jj]) {
+                exy = Ec[Ii][Jj];
+            }
+
+            Ef[i][j] +=       wx  *      wy  * e0
+                     + (1 - wx) *      wy  * ex
+                     +       wx  * (1 - wy) * ey
+                     + (1 - wx) * (1 - wy) * exy;
+        }
+    }
+}
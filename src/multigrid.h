@@ -0,0 +1,76 @@
+#ifndef MULTIGRID_K3QZ7T1D
+#define MULTIGRID_K3QZ7T1D
+
+#include "field2d.h"
+#include "cell_lists.h"
+#include <vector>
+
+// forward declaration
+class Parameters;
+
+// Recursion pattern of a multigrid cycle
+enum multigrid_cycle {
+    MG_V_CYCLE = 1,         // visit every coarse level once
+    MG_W_CYCLE = 2          // visit every coarse level twice
+};
+
+/**
+ * Geometric multigrid solver for the pressure Poisson equation.
+ *
+ * All levels use the same cell-centred 5-point stencil restricted to fluid
+ * cells: obstacles and walls are Neumann, left/right walls where a pressure
+ * is prescribed are Dirichlet. Every level is smoothed with red-black
+ * Gauss-Seidel sweeps.
+ *
+ * Coarse levels are built by merging 2x2 cells, or only 2x1 / 1x2 cells while
+ * the cells are stretched, so that the point smoother keeps working on
+ * anisotropic grids. A coarse cell is fluid if any of its children is. The
+ * coarse levels solve for the error with homogeneous boundary values.
+ *
+ * With Neumann conditions all around, the mean of RS is removed first: it
+ * can't be matched by any pressure and would keep the residual above eps.
+ *
+ * The hierarchy is allocated once from the Flag field, cycle() may then be
+ * called in place of sor(). It leaves the obstacle and ghost values of P set
+ * just like sor() does.
+ */
+class Multigrid {
+    public:
+        Multigrid (Parameters const &params, Field2D<int> const &Flag, CellLists const &cells);
+
+        // Perform one V- or W-cycle on P and store the RMS residual in res,
+        // and the sum of P over the fluid cells in psum if given
+        void cycle (Field2D<double> &P, Field2D<double> &RS, double *res, double *psum = 0);
+
+        unsigned int nof_levels () const;
+
+    private:
+        struct level_t {
+            int imax, jmax;
+            double dx, dy;
+            int cx, cy;      // number of children per cell in x and y direction
+            double pl, pr;   // Dirichlet values, zero on the coarse levels
+            Field2D<int>    fluid;   // 1 for fluid cells, 0 for obstacles and the ghost layer
+            Field2D<double> *E;      // unknown: P on the finest level, error below
+            Field2D<double> error;   // storage of E on the coarse levels
+            Field2D<double> R;       // right-hand side: a copy of RS on the finest level
+            Field2D<double> T;       // residual, restricted to the next level
+        };
+
+        void cycle_level (unsigned int l);
+        void smooth      (level_t &lv, unsigned int sweeps);
+        void residual    (level_t &lv, double *rss = 0, double *esum = 0);
+        void restrict_to (level_t const &fine, level_t &coarse);
+        void prolongate  (level_t const &coarse, level_t const &fine);
+
+        Parameters const &params;
+        CellLists const &cells;
+        std::vector<level_t> levels;
+        bool dirichlet_left, dirichlet_right;
+
+        // copying would leave E pointing to the other hierarchy
+        Multigrid (Multigrid const &);
+        Multigrid &operator= (Multigrid const &);
+};
+
+#endif /* end of include guard: MULTIGRID_K3QZ7T1D */
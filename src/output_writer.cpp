@@ -0,0 +1,96 @@
+#include "output_writer.h"
+#include "Parameters.h"
+#include "visual.h"
+
+
+OutputWriter::OutputWriter (Parameters const &params)
+    : params(params), snapshots(params.out_snapshots), done(false)
+{
+    if (snapshots.empty()) return;
+
+    for (size_t k = 0; k < snapshots.size(); ++k) {
+        snapshots[k].C.resize(params.nof_substances());
+        spare.push(&snapshots[k]);
+    }
+    writer = std::thread(&OutputWriter::run, this);
+}
+
+
+OutputWriter::~OutputWriter ()
+{
+    finish();
+}
+
+
+void OutputWriter::write (unsigned int n, Field2D<double> const &U, Field2D<double> const &V,
+                          Field2D<double> const &P, Field2D<double> const &T,
+                          std::vector<Field2D<double> > const &C)
+{
+    if (params.out_format == OUTPUT_NONE) return;
+
+    if (snapshots.empty()) {
+        write_vtkFile(params.out_prefix, n, params, U, V, P, T, C);
+        return;
+    }
+
+    snapshot_t *s;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (spare.empty()) changed.wait(lock);
+        s = spare.front();
+        spare.pop();
+    }
+
+    // Only this thread touches a snapshot between taking it from the spare
+    // queue and handing it to the writer
+    s->n = n;
+    s->U.assign(U);
+    s->V.assign(V);
+    s->P.assign(P);
+    s->T.assign(T);
+    for (size_t k = 0; k < C.size(); ++k) s->C[k].assign(C[k]);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push(s);
+    }
+    changed.notify_all();
+}
+
+
+void OutputWriter::finish ()
+{
+    if (!writer.joinable()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+    changed.notify_all();
+    writer.join();
+}
+
+
+// Writer thread: write pending snapshots in order until finish() was called
+// and nothing is left
+void OutputWriter::run ()
+{
+    while (true) {
+        snapshot_t *s;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (pending.empty() && !done) changed.wait(lock);
+            if (pending.empty()) return;
+            s = pending.front();
+            pending.pop();
+        }
+
+        write_vtkFile(params.out_prefix, s->n, params, s->U, s->V, s->P, s->T, s->C);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            spare.push(s);
+        }
+        changed.notify_all();
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef OUTPUT_WRITER_M3QF8T6J
+#define OUTPUT_WRITER_M3QF8T6J
+
+#include "field2d.h"
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// forward declaration
+class Parameters;
+
+/**
+ * Writes the VTK files on a background thread.
+ *
+ * write() copies U, V, P, T and C into one of params.out_snapshots spare
+ * buffers and returns, the writer thread then calls write_vtkFile() on the
+ * copy. If all buffers are still waiting to be written, write() blocks until
+ * one is free, so a slow disk holds the solver back instead of piling up
+ * copies.
+ *
+ * With out_snapshots = 0 write() calls write_vtkFile() directly.
+ * finish(), also called by the destructor, waits for all pending files.
+ */
+class OutputWriter {
+    public:
+        OutputWriter (Parameters const &params);
+        ~OutputWriter ();
+
+        void write (unsigned int n, Field2D<double> const &U, Field2D<double> const &V,
+                    Field2D<double> const &P, Field2D<double> const &T,
+                    std::vector<Field2D<double> > const &C);
+
+        void finish ();
+
+    private:
+        struct snapshot_t {
+            unsigned int n;
+            Field2D<double> U, V, P, T;
+            std::vector<Field2D<double> > C;
+        };
+
+        void run ();
+
+        Parameters const &params;
+        std::vector<snapshot_t> snapshots;
+        std::queue<snapshot_t *> spare, pending;
+        bool done;
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::thread writer;
+
+        // the writer thread refers to this object
+        OutputWriter (OutputWriter const &);
+        OutputWriter &operator= (OutputWriter const &);
+};
+
+#endif /* end of include guard: OUTPUT_WRITER_M3QF8T6J */
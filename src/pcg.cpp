@@ -0,0 +1,255 @@
+#include "pcg.h"
+#include "Parameters.h"
+#include "boundary_conditions.h"
+#include "sor.h"
+#include <math.h>
+
+
+Pcg::Pcg (Parameters const &params, Field2D<int> const &Flag, CellLists const &cells)
+    : params(params), cells(cells),
+      dirichlet_left (params.wlvp == BC_PRESSURE),
+      dirichlet_right(params.wrvp == BC_PRESSURE),
+      counter(0),
+      active(params.imax, params.jmax),
+      diag  (params.imax, params.jmax),
+      pivot (params.imax, params.jmax),
+      r     (params.imax, params.jmax),
+      z     (params.imax, params.jmax),
+      p     (params.imax, params.jmax),
+      q     (params.imax, params.jmax)
+{
+    int imax = params.imax, jmax = params.jmax;
+    double idx2 = 1 / (params.dx * params.dx), idy2 = 1 / (params.dy * params.dy);
+
+    // Diagonal: one entry per fluid neighbour, twice that behind a Dirichlet
+    // wall. Top and bottom are always Neumann for the pressure, see sor().
+    for (int i = 1; i <= imax; ++i) {
+        for (int j = 1; j <= jmax; ++j) {
+            if (!(Flag[i][j] & 16)) continue;
+
+            double d = 0;
+            if (Flag[i-1][j] & 16) d += idx2;
+            else if (i == 1 && dirichlet_left) d += 2 * idx2;
+            if (Flag[i+1][j] & 16) d += idx2;
+            else if (i == imax && dirichlet_right) d += 2 * idx2;
+            if (Flag[i][j-1] & 16) d += idy2;
+            if (Flag[i][j+1] & 16) d += idy2;
+
+            // isolated cells have no equation
+            if (d > 0) {
+                diag[i][j]   = d;
+                active[i][j] = 1;
+                counter++;
+            }
+        }
+    }
+
+    // IC(0) pivots, in the same order as the forward substitution. Without
+    // a Dirichlet wall the operator is singular and the last pivots may get
+    // arbitrarily small, those fall back to the diagonal.
+    for (int i = 1; i <= imax; ++i) {
+        for (int j = 1; j <= jmax; ++j) {
+            if (!active[i][j]) continue;
+
+            double d = diag[i][j];
+            if (active[i-1][j]) d -= idx2 * idx2 / pivot[i-1][j];
+            if (active[i][j-1]) d -= idy2 * idy2 / pivot[i][j-1];
+            pivot[i][j] = (d > 1e-3 * diag[i][j]) ? d : diag[i][j];
+        }
+    }
+}
+
+
+unsigned int Pcg::solve (Field2D<double> &P, Field2D<double> &RS, double *res, double *psum)
+{
+    int imax = params.imax, jmax = params.jmax;
+    double idx2 = 1 / (params.dx * params.dx), idy2 = 1 / (params.dy * params.dy);
+
+    // Without any Dirichlet wall a constant doesn't change the residual, the
+    // mean of P is then removed along with the updates of P
+    bool centre = !dirichlet_left && !dirichlet_right;
+
+    // Initial residual r = RS - laplace(P). P may hold anything on obstacles
+    // and in the ghost layer, so only active neighbours are read here. The
+    // sum of P includes the isolated cells, like the mean removed in main.
+    double sum = 0, p_sum = 0;
+    #pragma omp parallel for reduction(+:sum,p_sum)
+    for (size_t n = 0; n < cells.fluid.size(); ++n) {
+        int i = cells.fluid[n].i;
+        for (int j = cells.fluid[n].jlow; j <= cells.fluid[n].jhigh; ++j) {
+            p_sum += P[i][j];
+            if (!active[i][j]) continue;
+
+            double lap = idx2 * (active[i-1][j] * P[i-1][j] + active[i+1][j] * P[i+1][j])
+                       + idy2 * (active[i][j-1] * P[i][j-1] + active[i][j+1] * P[i][j+1])
+                       - diag[i][j] * P[i][j];
+            if (i == 1    && dirichlet_left)  lap += 2 * idx2 * params.pl;
+            if (i == imax && dirichlet_right) lap += 2 * idx2 * params.pr;
+
+            r[i][j] = lap - RS[i][j];
+            sum += RS[i][j];
+        }
+    }
+
+    // Without any Dirichlet wall only the part of RS with zero mean can be
+    // matched, the rest would keep the residual from ever dropping below eps.
+    if (!dirichlet_left && !dirichlet_right) {
+        double mean = sum / counter;
+        #pragma omp parallel for
+        for (int i = 1; i <= imax; ++i) {
+            for (int j = 1; j <= jmax; ++j) {
+                if (active[i][j]) r[i][j] += mean;
+            }
+        }
+    }
+
+    // The operator is -laplace, so r is also b - A P for the system A P = b
+    // CG is working on.
+    *res = sqrt(dot(r, r) / counter);
+
+    unsigned int it = 0;
+    if (*res <= params.eps) {
+        sor_obstacle_boundaries(P, cells);
+        sor_domain_boundaries(imax, jmax, P, params.wlvp, params.wrvp, params.wtvp, params.wbvp, params.pl, params.pr, params.pt, params.pb);
+        if (psum) *psum = p_sum;
+        return it;
+    }
+
+    apply_preconditioner(r, z);
+    double rz = dot(r, z);
+
+    // p is 0 on inactive cells, as z is
+    double d_sum = 0;
+    #pragma omp parallel for reduction(+:d_sum)
+    for (int i = 1; i <= imax; ++i) {
+        for (int j = 1; j <= jmax; ++j) {
+            p[i][j] = z[i][j];
+            d_sum += p[i][j];
+        }
+    }
+
+    while (it < params.itermax) {
+        apply_operator(p, q);
+        double alpha = rz / dot(p, q);
+
+        // The sum of the updated P is known in advance from those of P and
+        // p, its mean can be removed in the same pass. CG itself only reads
+        // P for the initial residual
+        double shift = centre ? (p_sum + alpha * d_sum) / cells.nof_fluid : 0;
+
+        // update the solution and the residual in one pass
+        double rr = 0, sum_new = 0;
+        #pragma omp parallel for reduction(+:rr,sum_new)
+        for (size_t n = 0; n < cells.fluid.size(); ++n) {
+            int i = cells.fluid[n].i;
+            for (int j = cells.fluid[n].jlow; j <= cells.fluid[n].jhigh; ++j) {
+                if (active[i][j]) {
+                    P[i][j] += alpha * p[i][j] - shift;
+                    r[i][j] -= alpha * q[i][j];
+                    rr += r[i][j] * r[i][j];
+                }
+                else {
+                    P[i][j] -= shift;
+                }
+                sum_new += P[i][j];
+            }
+        }
+        p_sum = sum_new;
+        ++it;
+
+        *res = sqrt(rr / counter);
+        if (*res <= params.eps) break;
+
+        apply_preconditioner(r, z);
+        double rz_new = dot(r, z);
+        double beta = rz_new / rz;
+        rz = rz_new;
+
+        d_sum = 0;
+        #pragma omp parallel for reduction(+:d_sum)
+        for (int i = 1; i <= imax; ++i) {
+            for (int j = 1; j <= jmax; ++j) {
+                if (active[i][j]) {
+                    p[i][j] = z[i][j] + beta * p[i][j];
+                    d_sum += p[i][j];
+                }
+            }
+        }
+    }
+
+    // obstacle and ghost values for the rest of the time step
+    sor_obstacle_boundaries(P, cells);
+    sor_domain_boundaries(imax, jmax, P, params.wlvp, params.wrvp, params.wtvp, params.wbvp, params.pl, params.pr, params.pt, params.pb);
+
+    // what is left of the mean is round-off
+    if (psum) *psum = (centre && it > 0) ? 0 : p_sum;
+    return it;
+}
+
+
+// Y = -laplace(X) with homogeneous boundary values. X is zero on all inactive
+// cells, so no neighbour needs to be masked.
+void Pcg::apply_operator (Field2D<double> &X, Field2D<double> &Y)
+{
+    double idx2 = 1 / (params.dx * params.dx), idy2 = 1 / (params.dy * params.dy);
+
+    #pragma omp parallel for
+    for (int i = 1; i <= params.imax; ++i) {
+        for (int j = 1; j <= params.jmax; ++j) {
+            if (active[i][j]) {
+                Y[i][j] = diag[i][j] * X[i][j]
+                        - idx2 * (X[i-1][j] + X[i+1][j])
+                        - idy2 * (X[i][j-1] + X[i][j+1]);
+            }
+        }
+    }
+}
+
+
+void Pcg::apply_preconditioner (Field2D<double> &R, Field2D<double> &Z)
+{
+    int imax = params.imax, jmax = params.jmax;
+
+    if (params.pcg_preconditioner == PCG_JACOBI) {
+        #pragma omp parallel for
+        for (int i = 1; i <= imax; ++i) {
+            for (int j = 1; j <= jmax; ++j) {
+                if (active[i][j]) Z[i][j] = R[i][j] / diag[i][j];
+            }
+        }
+        return;
+    }
+
+    // IC(0): the lower neighbours are west and south. Forward substitution
+    // with L, then backward substitution with L^T. Both are sequential.
+    double idx2 = 1 / (params.dx * params.dx), idy2 = 1 / (params.dy * params.dy);
+
+    for (int i = 1; i <= imax; ++i) {
+        for (int j = 1; j <= jmax; ++j) {
+            if (active[i][j]) {
+                Z[i][j] = (R[i][j] + idx2 * Z[i-1][j] + idy2 * Z[i][j-1]) / pivot[i][j];
+            }
+        }
+    }
+    for (int i = imax; i >= 1; --i) {
+        for (int j = jmax; j >= 1; --j) {
+            if (active[i][j]) {
+                Z[i][j] += (idx2 * Z[i+1][j] + idy2 * Z[i][j+1]) / pivot[i][j];
+            }
+        }
+    }
+}
+
+
+double Pcg::dot (Field2D<double> &X, Field2D<double> &Y)
+{
+    double sum = 0;
+
+    #pragma omp parallel for reduction(+:sum)
+    for (int i = 1; i <= params.imax; ++i) {
+        for (int j = 1; j <= params.jmax; ++j) {
+            if (active[i][j]) sum += X[i][j] * Y[i][j];
+        }
+    }
+    return sum;
+}
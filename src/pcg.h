@@ -0,0 +1,57 @@
+#ifndef PCG_R4WN8E2M
+#define PCG_R4WN8E2M
+
+#include "field2d.h"
+#include "cell_lists.h"
+
+// forward declaration
+class Parameters;
+
+// Preconditioner applied in every CG iteration
+enum pcg_preconditioner {
+    PCG_JACOBI                = 0,  // divide by the diagonal, fully parallel
+    PCG_INCOMPLETE_CHOLESKY   = 1   // IC(0), forward and backward substitution
+};
+
+/**
+ * Preconditioned conjugate gradient solver for the pressure Poisson equation.
+ *
+ * The operator is the negative 5-point stencil of sor(), applied matrix-free
+ * on the fluid cells: fluid neighbours couple, obstacles and walls are
+ * Neumann, left/right walls where a pressure is prescribed are Dirichlet.
+ * This makes the system symmetric positive (semi-)definite.
+ *
+ * With Neumann conditions all around, the mean of RS is removed first: it
+ * can't be matched by any pressure and CG would diverge on it. The mean of
+ * P is removed along with every update of P.
+ *
+ * The diagonal and the IC(0) pivots only depend on the geometry and are set
+ * up once. solve() may then be called in place of the SOR loop and leaves
+ * the obstacle and ghost values of P set just like sor() does.
+ */
+class Pcg {
+    public:
+        Pcg (Parameters const &params, Field2D<int> const &Flag, CellLists const &cells);
+
+        // Iterate until the RMS residual drops below eps or itermax is
+        // reached. The residual is stored in res, the number of iterations
+        // returned. psum, if given, receives the sum of P over the fluid
+        // cells, 0 if the mean was removed already.
+        unsigned int solve (Field2D<double> &P, Field2D<double> &RS, double *res, double *psum = 0);
+
+    private:
+        void   apply_operator       (Field2D<double> &X, Field2D<double> &Y);
+        void   apply_preconditioner (Field2D<double> &R, Field2D<double> &Z);
+        double dot                  (Field2D<double> &X, Field2D<double> &Y);
+
+        Parameters const &params;
+        CellLists const &cells;
+        bool dirichlet_left, dirichlet_right;
+        int counter;                // number of active cells
+        Field2D<int>    active;     // 1 for fluid cells with at least one equation
+        Field2D<double> diag;       // diagonal of the operator
+        Field2D<double> pivot;      // IC(0) pivots
+        Field2D<double> r, z, p, q;
+};
+
+#endif /* end of include guard: PCG_R4WN8E2M */
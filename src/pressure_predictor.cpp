@@ -0,0 +1,79 @@
+#include "pressure_predictor.h"
+#include "Parameters.h"
+#include "sor.h"
+
+
+PressurePredictor::PressurePredictor (Parameters const &params, CellLists const &cells)
+    : params(params), order(params.predictor), cells(cells)
+{
+    if (order >= PREDICTOR_LINEAR) {
+        P_last.allocate(params.imax, params.jmax);
+        D1.allocate(params.imax, params.jmax);
+    }
+    if (order >= PREDICTOR_QUADRATIC) {
+        D2.allocate(params.imax, params.jmax);
+    }
+}
+
+
+bool PressurePredictor::predict (Field2D<double> &P, double dt, double dt_prev, unsigned int n) const
+{
+    // D1 needs two solutions, D2 three. The first step starts from the
+    // initial pressure, which is no solution
+    bool linear    = (order >= PREDICTOR_LINEAR && n >= 2);
+    bool quadratic = (order >= PREDICTOR_QUADRATIC && n >= 3);
+    if (!linear) return false;
+
+    double c1 = dt, c2 = dt * (dt + dt_prev);
+
+    #pragma omp parallel for schedule(static)
+    for (size_t r = 0; r < cells.fluid.size(); r++) {
+        int i = cells.fluid[r].i;
+        for (int j = cells.fluid[r].jlow; j <= cells.fluid[r].jhigh; j++) {
+            double p = P_last[i][j] + c1 * D1[i][j];
+            if (quadratic) p += c2 * D2[i][j];
+            P[i][j] = p;
+        }
+    }
+
+    sor_obstacle_boundaries(P, cells);
+    sor_domain_boundaries(params.imax, params.jmax, P, params.wlvp, params.wrvp, params.wtvp, params.wbvp,
+                          params.pl, params.pr, params.pt, params.pb);
+    return true;
+}
+
+
+void PressurePredictor::update (Field2D<double> &P, double mean, double dt, double dt_prev, unsigned int n)
+{
+    bool linear    = (order >= PREDICTOR_LINEAR && n >= 1);
+    bool quadratic = (order >= PREDICTOR_QUADRATIC && n >= 2);
+
+    // The solver removed the mean already
+    if (order == PREDICTOR_NONE && mean == 0) return;
+
+    #pragma omp parallel for schedule(static)
+    for (size_t r = 0; r < cells.fluid.size(); r++) {
+        int i = cells.fluid[r].i;
+        for (int j = cells.fluid[r].jlow; j <= cells.fluid[r].jhigh; j++) {
+            double p = P[i][j] - mean;
+            P[i][j] = p;
+            if (order == PREDICTOR_NONE) continue;
+
+            if (linear) {
+                double d1 = (p - P_last[i][j]) / dt;
+                if (quadratic) D2[i][j] = (d1 - D1[i][j]) / (dt + dt_prev);
+                D1[i][j] = d1;
+            }
+            P_last[i][j] = p;
+        }
+    }
+}
+
+
+std::vector<Field2D<double> *> PressurePredictor::fields ()
+{
+    std::vector<Field2D<double> *> history;
+    if (order >= PREDICTOR_LINEAR)    { history.push_back(&P_last);  history.push_back(&D1); }
+    if (order >= PREDICTOR_QUADRATIC) { history.push_back(&D2); }
+    return history;
+}
@@ -0,0 +1,63 @@
+#ifndef PRESSURE_PREDICTOR_D4W7PZ3K
+#define PRESSURE_PREDICTOR_D4W7PZ3K
+
+#include "field2d.h"
+#include "cell_lists.h"
+#include <vector>
+
+// forward declaration
+class Parameters;
+
+// Initial guess of the pressure solver, <sor><predictor>. The value is the
+// number of previous solutions the extrapolation uses besides the last one
+enum pressure_predictor {
+    PREDICTOR_NONE      = 0,    // start from the last pressure
+    PREDICTOR_LINEAR    = 1,    // extrapolate from the last two
+    PREDICTOR_QUADRATIC = 2     // extrapolate from the last three
+};
+
+/**
+ * Extrapolates the pressure in time to give the iterative solvers a better
+ * starting point.
+ *
+ * The last solution and its divided differences in time are kept, so
+ * varying time steps are accounted for (Newton form of the interpolating
+ * polynomial). n is the number of time steps done so far: the history fills
+ * up during the first steps and after a restart is taken from the
+ * checkpoint, see fields().
+ *
+ * This pays off if eps is small compared to the change of the pressure from
+ * one step to the next. The error every solve leaves behind is extrapolated
+ * as well, and with a loose eps it grows until the solver needs more
+ * iterations than without a predictor.
+ *
+ * update() removes the mean from the new solution and records it, in one
+ * pass over the fluid cells. Without a predictor it only removes the mean,
+ * and does nothing if the solver did so already.
+ */
+class PressurePredictor {
+    public:
+        PressurePredictor (Parameters const &params, CellLists const &cells);
+
+        // Replaces P by its extrapolation to the end of the step dt,
+        // dt_prev being the step before, and sets its boundary values like
+        // sor(). true if there was enough history to do so
+        bool predict (Field2D<double> &P, double dt, double dt_prev, unsigned int n) const;
+
+        // Subtracts mean from the new solution P and records it
+        void update (Field2D<double> &P, double mean, double dt, double dt_prev, unsigned int n);
+
+        // The history, to be stored in checkpoints
+        std::vector<Field2D<double> *> fields ();
+
+    private:
+        Parameters const &params;
+        int order;
+        CellLists const &cells;
+
+        Field2D<double> P_last;     // last solution
+        Field2D<double> D1;         // first divided difference
+        Field2D<double> D2;         // second divided difference
+};
+
+#endif /* end of include guard: PRESSURE_PREDICTOR_D4W7PZ3K */
@@ -0,0 +1,172 @@
+#include "profiler.h"
+#include "Parameters.h"
+#include "cell_lists.h"
+#include "helper.h"
+
+#include <string.h>
+#include <sys/resource.h>
+
+
+Profiler::Profiler (Parameters const &params, CellLists const &cells)
+    : created(clock::now()), steps(0), steps_format(params.profile_steps), steps_file(0)
+{
+    double fluid     = cells.nof_fluid;
+    double grid      = (double)params.imax * params.jmax;
+    double storage   = (double)(params.imax + 2) * (params.jmax + 2);
+    double nC        = params.nof_substances();
+    double boundary  = 2.0 * (params.imax + params.jmax);
+    for (int o = 1; o < 16; ++o) boundary += cells.boundary[o].size();
+
+    // name, cells per call and doubles read or written per cell
+    struct { char const *name; double cells, doubles; } model[NOF_PHASES] = {
+        { "boundary",    boundary,     4 + nC },     // U, V, T, C and F, G at obstacles
+        { "rates",       fluid,        1 + 3 * nC }, // T, C read, C written if negative, R written
+        { "timestep",    fluid,        2 * nC },     // C, R, plus U, V on the whole grid below
+        { "reaction",    fluid,        2 + 3 * nC }, // R read, T, C read and written
+        { "transport",   fluid,        4 + 2 * nC }, // U, V, T, C read, T_new, C_new written
+        { "fg",          fluid,        5 },          // U, V, T read, F, G written
+        { "rs",          fluid,        3 },          // F, G read, RS written
+        { "fg_rs",       fluid,        6 },          // U, V, T read, F, G, RS written
+        { "pressure",    fluid,        3 },          // P, RS read, P written
+        { "normalize",   fluid,        2 },          // P read and written, once without SOR
+        { "uv",          fluid,        5 },          // F, G, P read, U, V written
+        { "monitor",     fluid,        9 + 3 * nC }, // U, V, T, C and their copies read, copies written
+        { "output",      grid,         4 + nC },     // U, V, P, T, C
+        { "checkpoint",  storage,      8 + nC }      // all fields of the time loop
+    };
+
+    for (int p = 0; p < NOF_PHASES; ++p) {
+        phases[p].name         = model[p].name;
+        phases[p].cells        = model[p].cells;
+        phases[p].bytes        = model[p].cells * model[p].doubles * sizeof(double);
+        phases[p].calls        = 0;
+        phases[p].seconds      = 0;
+        phases[p].step_seconds = 0;
+        phases[p].total_cells  = 0;
+        phases[p].total_bytes  = 0;
+    }
+    phases[PHASE_DT].bytes += 2 * storage * sizeof(double);
+
+    if (steps_format == PROFILE_STEPS_NONE) return;
+
+    steps_file = fopen(params.profile_file.c_str(), "w");
+    if (!steps_file) ERROR(("Failed to open " + params.profile_file).c_str());
+
+    if (steps_format == PROFILE_STEPS_CSV) {
+        fprintf(steps_file, "n,t,dt,iterations");
+        for (int p = 0; p < NOF_PHASES; ++p) fprintf(steps_file, ",%s", phases[p].name);
+        fprintf(steps_file, ",total\n");
+    }
+    else {
+        fprintf(steps_file, "[");
+    }
+}
+
+
+Profiler::~Profiler ()
+{
+    if (!steps_file) return;
+
+    if (steps_format == PROFILE_STEPS_JSON) fprintf(steps_file, "\n]\n");
+    fclose(steps_file);
+}
+
+
+void Profiler::begin_step ()
+{
+    step_started = clock::now();
+    for (int p = 0; p < NOF_PHASES; ++p) phases[p].step_seconds = 0;
+}
+
+
+void Profiler::start (int phase)
+{
+    phases[phase].started = clock::now();
+}
+
+
+void Profiler::stop (int phase, unsigned int repetitions)
+{
+    phase_t &p = phases[phase];
+    double seconds = std::chrono::duration<double>(clock::now() - p.started).count();
+
+    p.calls++;
+    p.seconds      += seconds;
+    p.step_seconds += seconds;
+    p.total_cells  += repetitions * p.cells;
+    p.total_bytes  += repetitions * p.bytes;
+}
+
+
+void Profiler::end_step (unsigned int n, double t, double dt, unsigned int iterations)
+{
+    double seconds = std::chrono::duration<double>(clock::now() - step_started).count();
+    steps++;
+
+    if (!steps_file) return;
+
+    if (steps_format == PROFILE_STEPS_CSV) {
+        fprintf(steps_file, "%u,%.17g,%.17g,%u", n, t, dt, iterations);
+        for (int p = 0; p < NOF_PHASES; ++p) fprintf(steps_file, ",%.9f", phases[p].step_seconds);
+        fprintf(steps_file, ",%.9f\n", seconds);
+    }
+    else {
+        fprintf(steps_file, "%s\n  {\"n\": %u, \"t\": %.17g, \"dt\": %.17g, \"iterations\": %u, \"seconds\": {",
+                steps > 1 ? "," : "", n, t, dt, iterations);
+        for (int p = 0; p < NOF_PHASES; ++p) fprintf(steps_file, "\"%s\": %.9f, ", phases[p].name, phases[p].step_seconds);
+        fprintf(steps_file, "\"total\": %.9f}}", seconds);
+    }
+}
+
+
+// Peak resident set size of this process in kB. ru_maxrss is inherited
+// across exec from the parent, so VmHWM is preferred where /proc exists.
+static long peak_memory_kb ()
+{
+    long kb = -1;
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status) {
+        char line[256];
+        while (fgets(line, sizeof(line), status)) {
+            if (strncmp(line, "VmHWM:", 6) == 0) {
+                kb = atol(line + 6);
+                break;
+            }
+        }
+        fclose(status);
+    }
+    if (kb < 0) {
+        struct rusage usage;
+        kb = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+    }
+    return kb;
+}
+
+
+void Profiler::print_summary (FILE *out) const
+{
+    double profiled = 0;
+    for (int p = 0; p < NOF_PHASES; ++p) profiled += phases[p].seconds;
+
+    // Everything since the time loop was set up, including the final output
+    double total = std::chrono::duration<double>(clock::now() - created).count();
+
+    fprintf(out, "\nProfile of %lu time steps\n", steps);
+    fprintf(out, "%-12s %8s %10s %7s %10s %10s %8s\n",
+            "phase", "calls", "time [s]", "share", "ms/call", "Mcells/s", "GB/s");
+
+    for (int p = 0; p < NOF_PHASES; ++p) {
+        phase_t const &ph = phases[p];
+        if (ph.calls == 0) continue;
+
+        fprintf(out, "%-12s %8lu %10.3f %6.1f%% %10.3f %10.1f %8.2f\n",
+                ph.name, ph.calls, ph.seconds, 100 * ph.seconds / total,
+                1e3 * ph.seconds / ph.calls,
+                ph.seconds > 0 ? 1e-6 * ph.total_cells / ph.seconds : 0.0,
+                ph.seconds > 0 ? 1e-9 * ph.total_bytes / ph.seconds : 0.0);
+    }
+
+    fprintf(out, "%-12s %8s %10.3f %6.1f%%\n", "other", "", total - profiled, 100 * (total - profiled) / total);
+    fprintf(out, "%-12s %8lu %10.3f\n", "total", steps, total);
+    fprintf(out, "\nPeak memory: %ld kB\n", peak_memory_kb());
+}
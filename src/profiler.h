@@ -0,0 +1,115 @@
+#ifndef PROFILER_H9TW3XQ5
+#define PROFILER_H9TW3XQ5
+
+#include <chrono>
+#include <string>
+#include <stdio.h>
+
+// forward declarations
+class Parameters;
+class CellLists;
+
+// Phases of a time step, in the order they run
+enum profile_phase {
+    PHASE_BOUNDARY = 0,     // domain, inner and special boundary values
+    PHASE_RATES,            // clamp_concentrations, ReactionNetwork::rates
+    PHASE_DT,               // calculate_dt
+    PHASE_REACTION,         // compute_reaction
+    PHASE_TRANSPORT,        // calculate_next_scalars, C and T
+    PHASE_FG,               // calculate_fg
+    PHASE_RS,               // calculate_rs
+    PHASE_FG_RS,            // calculate_fg_rs, in place of the two above
+    PHASE_PRESSURE,         // pressure solver, counted per iteration
+    PHASE_NORMALIZE,        // pressure predictor, removal of the mean
+    PHASE_UV,               // calculate_uv
+    PHASE_MONITOR,          // SteadyStateMonitor::update
+    PHASE_OUTPUT,           // VTK output, time spent in the time loop
+    PHASE_CHECKPOINT,       // write_checkpoint
+    NOF_PHASES
+};
+
+// Per-step records written in addition to the summary, <profile><steps>
+enum profile_steps {
+    PROFILE_STEPS_NONE = 0,
+    PROFILE_STEPS_CSV  = 1,
+    PROFILE_STEPS_JSON = 2
+};
+
+/**
+ * Wall time, cells and bytes of every phase of the time loop.
+ *
+ * Cells and bytes are nominal: the cells a kernel updates and the fields it
+ * reads and writes per cell, taken once per call (per iteration for the
+ * pressure solver). They give an idea of the throughput of a phase, not
+ * measured memory traffic.
+ *
+ * print_summary() prints a table for the run so far, "other" being the time
+ * not spent in any phase. With params.profile_steps set, end_step() appends
+ * one record per time step to params.profile_file.
+ */
+class Profiler {
+    public:
+        Profiler (Parameters const &params, CellLists const &cells);
+        ~Profiler ();
+
+        void begin_step ();
+        void start (int phase);
+        void stop  (int phase, unsigned int repetitions = 1);
+        void end_step (unsigned int n, double t, double dt, unsigned int iterations);
+
+        void print_summary (FILE *out) const;
+
+    private:
+        typedef std::chrono::steady_clock clock;
+
+        struct phase_t {
+            char const *name;
+            double cells;           // per call
+            double bytes;           // per call
+            unsigned long calls;
+            double seconds;         // whole run
+            double step_seconds;    // current time step
+            double total_cells;
+            double total_bytes;
+            clock::time_point started;
+        };
+
+        phase_t phases[NOF_PHASES];
+        clock::time_point created;
+        clock::time_point step_started;
+        unsigned long steps;
+
+        int steps_format;
+        FILE *steps_file;
+
+        // owns the file
+        Profiler (Profiler const &);
+        Profiler &operator= (Profiler const &);
+};
+
+/**
+ * Times the enclosing scope as one call of a phase.
+ */
+class ScopedTimer {
+    public:
+        ScopedTimer (Profiler &profiler, int phase)
+            : profiler(profiler), phase(phase), repetitions(1)
+        {
+            profiler.start(phase);
+        }
+
+        ~ScopedTimer ()
+        {
+            profiler.stop(phase, repetitions);
+        }
+
+        // Count the call as k iterations of the phase
+        void repeat (unsigned int k) { repetitions = k; }
+
+    private:
+        Profiler &profiler;
+        int phase;
+        unsigned int repetitions;
+};
+
+#endif /* end of include guard: PROFILER_H9TW3XQ5 */
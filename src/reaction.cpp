@@ -1,133 +1,389 @@
 #include "reaction.h"
 
-// FInds K(T), the reaction rate temperature factos for a given pair of components
-inline double compute_k(
-        double activation, // Activation energy divided by R
-        double freq_factor,// frequency factor
-        double T // Temperature in absolute scale
-        ){
-    return freq_factor * exp( -activation / T );
-}
+// Largest integer exponent evaluated by repeated multiplication
+static const int max_integer_exponent = 8;
+
+ReactionNetwork::ReactionNetwork (const Parameters & params)
+    : nof_substances_(params.nof_substances()), T_inf(params.T_inf), vol_cp(params.vol_cp),
+      rtol(params.chem_rtol), atol(params.chem_atol), max_substeps(params.chem_max_substeps)
+{
+    for (unsigned int s = 0; s < nof_substances_; s++ ){
+        H_formation.push_back(params.substance[s].H_formation);
+    }
 
-// This thing calculates the reaction rate in a single point for a single
-// reaction.
-double single_reaction_rate(
-        double ***C,            // Array of concentration matrices
-        double **T,
-        double T_inf,
-        const reaction_t & reac,  // A reaction
-        int i,
-        int j
-        ){
+    for (unsigned int k = 0; k < params.reactions.size(); k++ ){
+        const reaction_t & reac = params.reactions[k];
+        compiled_reaction_t cr;
 
-    double temp = 1;
-    double value;
+        cr.freq_factor_forth = reac.freq_factor_forth;
+        cr.freq_factor_back  = reac.freq_factor_back;
+        cr.arrhenius_forth   = arrhenius_index(reac.activation_E_forth);
+        cr.arrhenius_back    = arrhenius_index(reac.activation_E_back);
 
-    // Deal with the reactants
-    for ( unsigned int k = 0; k < reac.reagents.size(); k++ ){
-        temp *= pow (C[reac.reagents[k]][i][j], reac.exponents_reagents[k]);
-    }
-    value =
-        compute_k( reac.activation_E_forth, reac.freq_factor_forth, T[i][j] + T_inf )
-        * temp;
-
-    // Now with the products
-    temp = 1;
-    for ( unsigned int k = 0; k < reac.products.size(); k++ ){
-        temp *= pow (C[reac.products[k]][i][j], reac.exponents_products[k]);
+        cr.first_reagent = factors.size();
+        for ( unsigned int s = 0; s < reac.reagents.size(); s++ ){
+            factors.push_back(make_factor(reac.reagents[s], reac.exponents_reagents[s]));
+        }
+        cr.first_product = factors.size();
+        for ( unsigned int s = 0; s < reac.products.size(); s++ ){
+            factors.push_back(make_factor(reac.products[s], reac.exponents_products[s]));
+        }
+        cr.end_factors = factors.size();
+
+        // Reagents decrease with forward reaction, products increase
+        cr.first_stoich = stoich.size();
+        for ( unsigned int s = 0; s < reac.reagents.size(); s++ ){
+            stoich_t st = { reac.reagents[s], -(double)reac.st_coeff_reagents[s] };
+            stoich.push_back(st);
+        }
+        for ( unsigned int s = 0; s < reac.products.size(); s++ ){
+            stoich_t st = { reac.products[s], (double)reac.st_coeff_products[s] };
+            stoich.push_back(st);
+        }
+        cr.end_stoich = stoich.size();
+
+        reactions.push_back(cr);
     }
-    value -=
-        compute_k( reac.activation_E_back, reac.freq_factor_back, T[i][j] + T_inf )
-        * temp;
+}
 
-    return value;
+// exp(-Ea/T) is computed once per cell for every distinct activation energy
+int ReactionNetwork::arrhenius_index (double activation)
+{
+    for (size_t a = 0; a < activations.size(); ++a) {
+        if (activations[a] == activation) return a;
+    }
+    activations.push_back(activation);
+    return activations.size() - 1;
+}
 
+ReactionNetwork::factor_t ReactionNetwork::make_factor (int substance, double exponent)
+{
+    factor_t f;
+    f.substance = substance;
+    f.exponent  = exponent;
+    f.integer   = (exponent == floor(exponent) && exponent >= 0 && exponent <= max_integer_exponent)
+                  ? (int)exponent : -1;
+    return f;
 }
 
-// Fills the reaction rate vector for a single point. That is, total rates for
-// every substance at a given point
-void compute_reaction_rate_vector(
-        double ***C,
-        double **T,
-        const Parameters & params,
-        std::vector<double> & rates,
-        int i,
-        int j
-        ){
+unsigned int ReactionNetwork::transcendentals_per_cell () const
+{
+    unsigned int n = activations.size();
+    for (size_t f = 0; f < factors.size(); ++f) {
+        if (factors[f].integer < 0) n++;
+    }
+    return n;
+}
 
-    double rr;
+// temp *= c^e for all cells of a run, by multiplication if e is a small
+// integer
+static inline void multiply_power (double *temp, double const *c, int n, double exponent, int integer)
+{
+    if (integer < 0) {
+        for (int m = 0; m < n; ++m) temp[m] *= pow(c[m], exponent);
+        return;
+    }
+    for (int m = 0; m < n; ++m) {
+        double p = 1;
+        for (int e = 0; e < integer; ++e) p *= c[m];
+        temp[m] *= p;
+    }
+}
 
-    // Reset the reaction rate vector for a new point
-    std::fill ( rates.begin(), rates.end(), 0 );
+void ReactionNetwork::rates (
+        std::vector<Field2D<double> > const &C,
+        Field2D<double> const &T,
+        CellLists const &cells,
+        std::vector<Field2D<double> > &R
+        ) const {
+
+    // Every thread works on whole runs with its own buffers of run length
+    #pragma omp parallel
+    {
+        int length = T.jmax();
+        std::vector<double> arrhenius(activations.size() * length), temp(length), rr(length), T_abs(length);
+
+        #pragma omp for schedule(static)
+        for (size_t r = 0; r < cells.fluid.size(); r++){
+            int i = cells.fluid[r].i, jlow = cells.fluid[r].jlow;
+            int n = cells.fluid[r].jhigh - jlow + 1;
+
+            for (int m = 0; m < n; ++m) T_abs[m] = T[i][jlow + m] + T_inf;
+            for (size_t a = 0; a < activations.size(); ++a) {
+                double *k = &arrhenius[a * length];
+                for (int m = 0; m < n; ++m) k[m] = exp( -activations[a] / T_abs[m] );
+            }
 
-    for (unsigned int k = 0; k < params.reactions.size(); k++ ){
+            for (unsigned int s = 0; s < nof_substances_; ++s) {
+                double *Rs = R[s][i] + jlow;
+                for (int m = 0; m < n; ++m) Rs[m] = 0;
+            }
 
-        // Get the reaction rate for reaction k
-        rr = single_reaction_rate(C, T, params.T_inf, params.reactions[k], i, j);
+            for (size_t k = 0; k < reactions.size(); ++k) {
+                compiled_reaction_t const &cr = reactions[k];
 
-        // 4th nested loop series! This one to store effects on every substance
-        // Reagents decrease with forward reaction
-        for( unsigned int s = 0; s < params.reactions[k].reagents.size(); s++ ){
-            rates[params.reactions[k].reagents[s]]
-                -= rr * params.reactions[k].st_coeff_reagents[s];
-        }
+                // Forward reaction, reagents
+                for (int m = 0; m < n; ++m) temp[m] = 1;
+                for (size_t f = cr.first_reagent; f < cr.first_product; ++f) {
+                    multiply_power(temp.data(), C[factors[f].substance][i] + jlow, n, factors[f].exponent, factors[f].integer);
+                }
+                double const *kf = arrhenius.data() + cr.arrhenius_forth * length;
+                for (int m = 0; m < n; ++m) rr[m] = cr.freq_factor_forth * kf[m] * temp[m];
 
-        // Products increase with forward reaction
-        for( unsigned int s = 0; s < params.reactions[k].products.size(); s++ ){
-            rates[params.reactions[k].products[s]]
-                += rr * params.reactions[k].st_coeff_products[s];
+                // Backward reaction, products
+                for (int m = 0; m < n; ++m) temp[m] = 1;
+                for (size_t f = cr.first_product; f < cr.end_factors; ++f) {
+                    multiply_power(temp.data(), C[factors[f].substance][i] + jlow, n, factors[f].exponent, factors[f].integer);
+                }
+                double const *kb = arrhenius.data() + cr.arrhenius_back * length;
+                for (int m = 0; m < n; ++m) rr[m] -= cr.freq_factor_back * kb[m] * temp[m];
+
+                // Effects on every substance
+                for (size_t st = cr.first_stoich; st < cr.end_stoich; ++st) {
+                    double *Rs = R[stoich[st].substance][i] + jlow;
+                    double coeff = stoich[st].coeff;
+                    for (int m = 0; m < n; ++m) Rs[m] += rr[m] * coeff;
+                }
+            }
         }
     }
-    // By now, the vector should contain the total reaction rates for everyone,
-    // Indexed in the same way as the C matrices are.
 }
 
-double reaction_max_dt(
-        double ***C,
-        double **T,
-        int** Flag,
-        const Parameters & params,
-        std::vector<double> & rates
-        ){
+// c^e of a single cell, by multiplication if e is a small integer
+static inline double power (double c, double exponent, int integer)
+{
+    if (integer < 0) return pow(c, exponent);
+    double p = 1;
+    for (int e = 0; e < integer; ++e) p *= c;
+    return p;
+}
 
-    double max_dt = DBL_MAX;
+void ReactionNetwork::cell_source (double const *c, double const *arrhenius, double *f, double *J, double *dw) const
+{
+    unsigned int n = nof_substances_;
+    for (unsigned int s = 0; s < n; ++s) f[s] = 0;
+    if (J) for (unsigned int s = 0; s < n * n; ++s) J[s] = 0;
 
-    // Sweep the whole domain
-    for (int i = 1; i <= params.imax; i++){
-        for (int j = 1; j <= params.jmax; j++ ){
+    for (size_t k = 0; k < reactions.size(); ++k) {
+        compiled_reaction_t const &cr = reactions[k];
 
-            // Check if the position is in the fluid
-            if (Flag[i][j] & 16){
+        double forth = cr.freq_factor_forth * arrhenius[cr.arrhenius_forth];
+        double back  = cr.freq_factor_back  * arrhenius[cr.arrhenius_back];
+        double w = forth, wb = back;
+        for (size_t a = cr.first_reagent; a < cr.first_product; ++a) w  *= power(c[factors[a].substance], factors[a].exponent, factors[a].integer);
+        for (size_t a = cr.first_product; a < cr.end_factors; ++a)   wb *= power(c[factors[a].substance], factors[a].exponent, factors[a].integer);
+        w -= wb;
 
-                // Force the concentration to be positive
-                // The reason is too long, send a message if curious
-                for ( unsigned int k = 0; k < rates.size(); k++ ){
-                    C[k][i][j] = (C[k][i][j] + fabs(C[k][i][j])) / 2;
-                }
+        for (size_t st = cr.first_stoich; st < cr.end_stoich; ++st) {
+            f[stoich[st].substance] += stoich[st].coeff * w;
+        }
+        if (!J) continue;
+
+        // dw/dc, the derivative of one factor times all the others
+        for (unsigned int s = 0; s < n; ++s) dw[s] = 0;
+        for (size_t a = cr.first_reagent; a < cr.end_factors; ++a) {
+            factor_t const &fa = factors[a];
+            bool reagent = a < cr.first_product;
+            double ca = c[fa.substance];
+
+            // The derivative of c^e with e < 1 is unbounded at c = 0, leave
+            // it out, the step size control takes care of the rest
+            if (fa.exponent == 0 || (ca <= 0 && fa.exponent < 1)) continue;
+
+            double d = (reagent ? forth : -back) * fa.exponent * power(ca, fa.exponent - 1, fa.integer > 0 ? fa.integer - 1 : -1);
+            size_t begin = reagent ? cr.first_reagent : cr.first_product;
+            size_t end   = reagent ? cr.first_product : cr.end_factors;
+            for (size_t b = begin; b < end; ++b) {
+                if (b != a) d *= power(c[factors[b].substance], factors[b].exponent, factors[b].integer);
+            }
+            dw[fa.substance] += d;
+        }
+        for (size_t st = cr.first_stoich; st < cr.end_stoich; ++st) {
+            double *row = J + stoich[st].substance * n;
+            for (unsigned int s = 0; s < n; ++s) row[s] += stoich[st].coeff * dw[s];
+        }
+    }
+}
 
-                compute_reaction_rate_vector(C, T, params, rates, i, j);
+// LU decomposition with partial pivoting of the small, dense n x n matrix M,
+// in place
+static void lu_decompose (double *M, int *pivot, int n)
+{
+    for (int k = 0; k < n; ++k) {
+        int p = k;
+        for (int i = k + 1; i < n; ++i) {
+            if (fabs(M[i * n + k]) > fabs(M[p * n + k])) p = i;
+        }
+        pivot[k] = p;
+        if (p != k) for (int j = 0; j < n; ++j) std::swap(M[k * n + j], M[p * n + j]);
+
+        // M = I - gamma h J is regular for small enough h, the caller
+        // rejects the step if it isn't
+        if (M[k * n + k] == 0) continue;
+        for (int i = k + 1; i < n; ++i) {
+            double l = M[i * n + k] /= M[k * n + k];
+            for (int j = k + 1; j < n; ++j) M[i * n + j] -= l * M[k * n + j];
+        }
+    }
+}
 
-                // Now see what would happen to every component
-                for ( unsigned int k = 0; k < rates.size(); k++ ){
+// Solves M x = b in place of b, M decomposed by lu_decompose()
+static void lu_solve (double const *M, int const *pivot, double *b, int n)
+{
+    for (int k = 0; k < n; ++k) {
+        if (pivot[k] != k) std::swap(b[k], b[pivot[k]]);
+        for (int i = k + 1; i < n; ++i) b[i] -= M[i * n + k] * b[k];
+    }
+    for (int k = n - 1; k >= 0; --k) {
+        for (int j = k + 1; j < n; ++j) b[k] -= M[k * n + j] * b[j];
+        b[k] /= M[k * n + k];
+    }
+}
 
-                    // Now I say that we only care if the product is being consumed
-                    // I'm not totally sure about that, but sounds good
-                    if ( rates[k] < 0 && (C[k][i][j] / -rates[k]) < max_dt ){
-                        max_dt = C[k][i][j] / -rates[k];
+chemistry_stats_t ReactionNetwork::integrate (
+        std::vector<Field2D<double> > &C,
+        Field2D<double> &T,
+        CellLists const &cells,
+        double dt,
+        Field2D<double> &H
+        ) const {
+
+    // ROS2, [Verwer et al. 1999]
+    const double gamma = 1 + 1 / sqrt(2.0);
+    int n = nof_substances_;
+
+    unsigned long accepted = 0, rejected = 0;
+
+    #pragma omp parallel reduction(+:accepted,rejected)
+    {
+        std::vector<double> y(n), y0(n), y1(n), f(n), k1(n), k2(n), dw(n), J(n * n), M(n * n), arrhenius(activations.size());
+        std::vector<int> pivot(n);
+
+        #pragma omp for schedule(dynamic, 16)
+        for (size_t r = 0; r < cells.fluid.size(); r++){
+            int i = cells.fluid[r].i;
+            for (int j = cells.fluid[r].jlow; j <= cells.fluid[r].jhigh; j++ ){
+
+                double T_abs = T[i][j] + T_inf;
+                for (size_t a = 0; a < activations.size(); ++a) arrhenius[a] = exp( -activations[a] / T_abs );
+
+                for (int s = 0; s < n; ++s) y[s] = y0[s] = C[s][i][j];
+
+                double t = 0;
+                double h = (H[i][j] > 0) ? std::min(H[i][j], dt) : dt;
+                double proposed = h;    // the step size before it was clipped to end at dt
+                unsigned int steps = 0;
+
+                while (t < dt) {
+                    // The last sub-step ends exactly at dt, if the cell runs
+                    // out of sub-steps it is taken whatever the error
+                    bool last = (++steps >= max_substeps);
+                    bool end  = last || t + h >= dt;
+                    if (end) {
+                        proposed = h;
+                        h = dt - t;
                     }
+
+                    // k1 and k2 from (I - gamma h J) k = ...
+                    cell_source(y.data(), arrhenius.data(), f.data(), J.data(), dw.data());
+                    for (int s = 0; s < n * n; ++s) M[s] = -gamma * h * J[s];
+                    for (int s = 0; s < n; ++s) M[s * n + s] += 1;
+                    lu_decompose(M.data(), pivot.data(), n);
+
+                    for (int s = 0; s < n; ++s) k1[s] = f[s];
+                    lu_solve(M.data(), pivot.data(), k1.data(), n);
+
+                    for (int s = 0; s < n; ++s) y1[s] = std::max(y[s] + h * k1[s], 0.0);
+                    cell_source(y1.data(), arrhenius.data(), f.data(), 0, dw.data());
+                    for (int s = 0; s < n; ++s) k2[s] = f[s] - 2 * k1[s];
+                    lu_solve(M.data(), pivot.data(), k2.data(), n);
+
+                    // Error against the embedded first order solution y + h k1
+                    double err = 0;
+                    for (int s = 0; s < n; ++s) {
+                        y1[s] = y[s] + 1.5 * h * k1[s] + 0.5 * h * k2[s];
+                        double scale = atol + rtol * std::max(fabs(y[s]), fabs(y1[s]));
+                        double e = 0.5 * h * (k1[s] + k2[s]) / scale;
+                        err += e * e;
+                    }
+                    err = sqrt(err / std::max(n, 1));
+
+                    if (err <= 1 || last) {
+                        for (int s = 0; s < n; ++s) y[s] = std::max(y1[s], 0.0);
+                        t = end ? dt : t + h;
+                        accepted++;
+                    }
+                    else {
+                        rejected++;
+                    }
+
+                    // NaN (singular M) counts as a large error
+                    double factor = (err == err) ? 0.9 / sqrt(std::max(err, 1e-10)) : 0.2;
+                    h *= std::min(5.0, std::max(0.2, factor));
+
+                    // The clipped last step only bounds the step size from
+                    // below, the next time step starts from the proposed one
+                    if (t >= dt) H[i][j] = (err <= 1) ? std::max(h, proposed) : proposed;
                 }
 
+                // The heat of formation of what has reacted
+                double heat_production = 0;
+                for (int s = 0; s < n; ++s) {
+                    heat_production -= H_formation[s] * (y[s] - y0[s]);
+                    C[s][i][j] = y[s];
+                }
+                T[i][j] += heat_production / vol_cp;
             }
+        }
+    }
+
+    chemistry_stats_t stats = { accepted, rejected };
+    return stats;
+}
+
 
-            /*
-            if ((C[0][i][j] && C[1][i][j]) || C[2][i][j]){
-                std::cout << "i: " << i << ", j: " << j
-                    << " <" << C[0][i][j] << ", " << C[1][i][j] << ", " << C[2][i][j] << ">" << std::endl
-                    << "Rrate: [" << rates[0] << ", " << rates[1] << ", " << rates[2] << "]" << std::endl
-                    << "Timestep: " << max_dt << std::endl << std::endl;
+void clamp_concentrations(
+        std::vector<Field2D<double> > &C,
+        CellLists const &cells
+        ){
+
+    // Force the concentration to be positive
+    // The reason is too long, send a message if curious
+    #pragma omp parallel for schedule(static)
+    for (size_t r = 0; r < cells.fluid.size(); r++){
+        int i = cells.fluid[r].i;
+        for ( unsigned int k = 0; k < C.size(); k++ ){
+            for (int j = cells.fluid[r].jlow; j <= cells.fluid[r].jhigh; j++ ){
+                C[k][i][j] = (C[k][i][j] + fabs(C[k][i][j])) / 2;
             }
-            */
+        }
+    }
+}
+
+
+double reaction_max_dt(
+        std::vector<Field2D<double> > const &C,
+        std::vector<Field2D<double> > const &R,
+        CellLists const &cells
+        ){
+
+    double max_dt = DBL_MAX;
+
+    // Sweep all fluid cells
+    #pragma omp parallel for schedule(static) reduction(min:max_dt)
+    for (size_t r = 0; r < cells.fluid.size(); r++){
+        int i = cells.fluid[r].i;
+        for (int j = cells.fluid[r].jlow; j <= cells.fluid[r].jhigh; j++ ){
+
+            // Now see what would happen to every component
+            for ( unsigned int k = 0; k < R.size(); k++ ){
 
+                // Now I say that we only care if the product is being consumed
+                // I'm not totally sure about that, but sounds good
+                if ( R[k][i][j] < 0 && (C[k][i][j] / -R[k][i][j]) < max_dt ){
+                    max_dt = C[k][i][j] / -R[k][i][j];
+                }
+            }
         }
     }
     assert(max_dt > 0);
@@ -137,41 +393,33 @@ double reaction_max_dt(
 
 // React!
 void compute_reaction(
-        double ***C,
-        double **T,
-        int **Flag,
+        std::vector<Field2D<double> > &C,
+        Field2D<double> &T,
+        CellLists const &cells,
         double dt,
         const Parameters & params,
-        std::vector<double> & rates
+        std::vector<Field2D<double> > const &R
         ){
 
-    double heat_production;
+    // For every fluid cell
+    #pragma omp parallel for schedule(static)
+    for (size_t r = 0; r < cells.fluid.size(); r++){
+        int i = cells.fluid[r].i;
+        for (int j = cells.fluid[r].jlow; j <= cells.fluid[r].jhigh; j++ ){
 
-    // For every point in the domain
-    for (int i = 1; i <= params.imax; i++){
-        for (int j = 1; j <= params.jmax; j++ ){
+            double heat_production = 0;
 
-            // that isn't an obstacle
-            if (Flag[i][j] & 16){
+            // And use an Euler integrator for every substance
+            for ( unsigned int k = 0; k < params.substance.size(); k++ ){
 
-                heat_production = 0;
-
-                // Get the reaction rate
-                compute_reaction_rate_vector(C, T, params, rates, i, j);
-
-                // And use an Euler integrator for every substance
-                for ( unsigned int k = 0; k < params.substance.size(); k++ ){
-
-                    C[k][i][j] += dt * rates[k];
-
-                    // Compute heat production
-                    heat_production -= params.substance[k].H_formation * rates[k];
-                }
+                C[k][i][j] += dt * R[k][i][j];
 
-                // Translate heat production to temperature change
-                T[i][j] += heat_production / params.vol_cp;
+                // Compute heat production
+                heat_production -= params.substance[k].H_formation * R[k][i][j];
             }
 
+            // Translate heat production to temperature change
+            T[i][j] += heat_production / params.vol_cp;
         }
     }
 }
@@ -4,27 +4,131 @@
 #include <math.h>
 #include <algorithm>
 #include "Parameters.h"
+#include "field2d.h"
+#include "cell_lists.h"
 #include <float.h>
 #include <assert.h>
 
+// How the reactions are integrated over a time step
+enum chemistry_integrator {
+    CHEMISTRY_EULER      = 0,   // explicit, limits the time step size
+    CHEMISTRY_ROSENBROCK = 1    // implicit, adaptive sub-steps in every cell
+};
+
+// Sub-steps of ReactionNetwork::integrate(), summed over all cells
+struct chemistry_stats_t {
+    unsigned long accepted;
+    unsigned long rejected;
+};
+
+// Sets negative concentrations in the fluid cells to zero. Needed before
+// the rates are computed, since the exponents are not integers in general
+void clamp_concentrations(
+        std::vector<Field2D<double> > &C,
+        CellLists const &cells
+        );
+
+/**
+ * The reactions of the parameters, compiled into flat arrays for the rate
+ * evaluation once after they have been read:
+ *
+ * - the concentration factors c^e of all reactions, with small integer
+ *   exponents evaluated by repeated multiplication instead of pow
+ * - the distinct activation energies, so that exp(-Ea/T) is computed once
+ *   per cell for all reactions and directions sharing one
+ * - a sparse stoichiometry matrix, the signed coefficients of the substances
+ *   every reaction changes
+ *
+ * rates() works on whole runs of cells, with unit-stride inner loops.
+ */
+class ReactionNetwork {
+    public:
+        ReactionNetwork (const Parameters & params);
+
+        // Total reaction rate of every substance in every fluid cell,
+        // R[k][i][j]. The rates are computed once per time step and used by
+        // both reaction_max_dt() and compute_reaction()
+        void rates (
+                std::vector<Field2D<double> > const &C,
+                Field2D<double> const &T,
+                CellLists const &cells,
+                std::vector<Field2D<double> > &R
+                ) const;
+
+        /**
+         * Integrates the reactions of every fluid cell over dt with the
+         * two-stage, L-stable Rosenbrock method ROS2 and the analytic
+         * Jacobian of the rates. The temperature is frozen during the step,
+         * the heat of the reactions is added afterwards. Every cell adapts
+         * its own sub-steps to the tolerances of the parameters and keeps
+         * the last size in H as a start for the next time step.
+         */
+        chemistry_stats_t integrate (
+                std::vector<Field2D<double> > &C,
+                Field2D<double> &T,
+                CellLists const &cells,
+                double dt,
+                Field2D<double> &H
+                ) const;
+
+        // Number of pow and exp calls rates() makes per fluid cell
+        unsigned int transcendentals_per_cell () const;
+
+    private:
+        struct factor_t {
+            int substance;
+            double exponent;
+            int integer;        // exponent if a small integer, -1 otherwise
+        };
+
+        struct stoich_t {
+            int substance;
+            double coeff;       // negative for reagents
+        };
+
+        struct compiled_reaction_t {
+            double freq_factor_forth, freq_factor_back;
+            int arrhenius_forth, arrhenius_back;    // indices into activations
+            size_t first_reagent, first_product, end_factors;
+            size_t first_stoich, end_stoich;
+        };
+
+        int arrhenius_index (double activation);
+        static factor_t make_factor (int substance, double exponent);
+
+        // Rates f and, if J is given, their Jacobian df/dc (row-major) of a
+        // single cell with concentrations c and exp(-Ea/T) in arrhenius
+        void cell_source (double const *c, double const *arrhenius, double *f, double *J, double *dw) const;
+
+        unsigned int nof_substances_;
+        double T_inf;
+        std::vector<double> H_formation;
+        double vol_cp;
+        double rtol, atol;
+        unsigned int max_substeps;
+        std::vector<double> activations;
+        std::vector<factor_t> factors;
+        std::vector<stoich_t> stoich;
+        std::vector<compiled_reaction_t> reactions;
+};
+
 // This function has to produce a time step for every component, at every
 // point, given all the reactions, that cannot produce a future negative value
 // for the concentration.
 double reaction_max_dt(
-        double ***C,
-        double **T,
-        int **Flag,
-        const Parameters & params,
-        std::vector<double> & rates
+        std::vector<Field2D<double> > const &C,
+        std::vector<Field2D<double> > const &R,
+        CellLists const &cells
         );
 
+// Explicit Euler step with the rates R
 void compute_reaction(
-        double ***C,
-        double **T,
-        int **Flag,
+        std::vector<Field2D<double> > &C,
+        Field2D<double> &T,
+        CellLists const &cells,
         double dt,
         const Parameters & params,
-        std::vector<double> & rates
+        std::vector<Field2D<double> > const &R
         );
 
 #endif
@@ -1,88 +1,63 @@
 #include "sor.h"
 #include "boundary_conditions.h"
+#include "helper.h"
 #include <math.h>
+#include <algorithm>
 
-enum obstacle_iface_orientation {
-    IFACE_IS_NORTH = 1,      // upper neighbour is a fluid cell
-    IFACE_IS_SOUTH = 2,      // lower neighbour is a fluid cell
-    IFACE_IS_WEST  = 4,      // left  neighbour is a fluid cell
-    IFACE_IS_EAST  = 8       // right neighbour is a fluid cell
-};
+// Set the pressure of obstacle boundary cells to the average of their fluid
+// neighbours. Every cell only reads fluid cells, so the loop can be split
+// among threads.
+void sor_obstacle_boundaries(Field2D<double> &P, CellLists const &cells)
+{
+  for (int o = 1; o < 16; o++) {
+    std::vector<cell_t> const &boundary = cells.boundary[o];
+    // The orientation has at least one fluid neighbour
+    double weight = 1.0 / (((o & IFACE_IS_NORTH) != 0) + ((o & IFACE_IS_SOUTH) != 0) +
+                           ((o & IFACE_IS_WEST)  != 0) + ((o & IFACE_IS_EAST)  != 0));
 
-void sor(
-  double omg,
-  double dx,
-  double dy,
-  int    imax,
-  int    jmax,
-  double **P,
-  double **RS,
-  double *res,
-  int    **Flag,
-  int wl, int wr, int wt, int wb,// Use this to determine what kind of boundary we have
-  double pl, double pr, double pt, double pb   // Pressures on the edges. Ignores if incorrect boundary type
-) {
-  int i,j, counter;
-  double rloc;
-  double coeff = omg/(2.0*(1.0/(dx*dx)+1.0/(dy*dy)));
-
-  /* SOR iteration */
-  for(i = 1; i <= imax; i++) {
-    for(j = 1; j <=jmax; j++) {
-      if (Flag[i][j] & 16){
-        P[i][j] = (1.0-omg)*P[i][j]
-                + coeff*(( P[i+1][j]+P[i-1][j])/(dx*dx) + ( P[i][j+1]+P[i][j-1])/(dy*dy) - RS[i][j]);
-      }
-    }
-  }
-  
-  // Extra loop for obstacle boundaries
-  for(i = 1; i <= imax; i++) {
-    for(j = 1; j <=jmax; j++) {
-      if ( !(Flag[i][j] & 16) && Flag[i][j]){ // If an obstacle but not an inner obstacle (Boundary cell)
-          P[i][j] = 0;  // Reset pressure
-          counter = 0;
-          for (int l = -1; l <= 1; l+=2){
-              if (Flag[i][j+l]){ // If one of the neighbours is fluid
-                  P[i][j] += P[i][j+l];
-                  counter++;
-              }
-          }
-          for (int l = -1; l <= 1; l+=2){
-              if (Flag[i+l][j]){ // If one of the neighbours is fluid
-                  P[i][j] += P[i+l][j];
-                  counter++;
-              }
-          }
-          P[i][j] /= counter; // To get an average if it's necessary
-          // The case where counter = 0 should not happen, since one of the
-          // conditions is to have at least one fluid neighbour
-      }
+    #pragma omp parallel for
+    for (size_t n = 0; n < boundary.size(); n++) {
+      int i = boundary[n].i, j = boundary[n].j;
+      double sum = 0;
+      if (o & IFACE_IS_NORTH) sum += P[i][j+1];
+      if (o & IFACE_IS_SOUTH) sum += P[i][j-1];
+      if (o & IFACE_IS_WEST)  sum += P[i-1][j];
+      if (o & IFACE_IS_EAST)  sum += P[i+1][j];
+      P[i][j] = weight * sum;
     }
   }
+}
 
-  /* compute the residual */
-  rloc = 0;
-  counter = 0;
-  for(i = 1; i <= imax; i++) {
-    for(j = 1; j <= jmax; j++) {
-        if (Flag[i][j] & 16){
-            rloc += ( (P[i+1][j]-2.0*P[i][j]+P[i-1][j])/(dx*dx) + ( P[i][j+1]-2.0*P[i][j]+P[i][j-1])/(dy*dy) - RS[i][j])*
-                ( (P[i+1][j]-2.0*P[i][j]+P[i-1][j])/(dx*dx) + ( P[i][j+1]-2.0*P[i][j]+P[i][j-1])/(dy*dy) - RS[i][j]);
-            counter++;
-        }
+// Root mean square of the residual over all fluid cells
+static double sor_residual(double dx, double dy, Field2D<double> &P, Field2D<double> &RS, CellLists const &cells)
+{
+  double rloc = 0;
+
+  #pragma omp parallel for reduction(+:rloc)
+  for(size_t n = 0; n < cells.fluid.size(); n++) {
+    int i = cells.fluid[n].i;
+    for(int j = cells.fluid[n].jlow; j <= cells.fluid[n].jhigh; j++) {
+        double r = (P[i+1][j]-2.0*P[i][j]+P[i-1][j])/(dx*dx) + ( P[i][j+1]-2.0*P[i][j]+P[i][j-1])/(dy*dy) - RS[i][j];
+        rloc += r*r;
     }
   }
-  rloc = rloc/counter;
-  rloc = sqrt(rloc);
-  /* set residual */
-  *res = rloc;
+  rloc = rloc/cells.nof_fluid;
+  return sqrt(rloc);
+}
 
+void sor_domain_boundaries(
+  int imax,
+  int jmax,
+  Field2D<double> &P,
+  int wl, int wr, int wt, int wb,
+  double pl, double pr, double pt, double pb
+) {
+  int i, j;
 
   // The worksheet states that we can have outflow only on the left or right,
   // so I'll just be taking those two into account.
 
-  if ( wl == boundary_condition["pressure"] ){
+  if ( wl == BC_PRESSURE ){
       for (j = 1; j <= jmax; j++){
           P[0][j] = 2 * pl - P[1][j];
       }
@@ -93,7 +68,7 @@ void sor(
       }
   }
 
-  if ( wr == boundary_condition["pressure"] ){
+  if ( wr == BC_PRESSURE ){
       for (j = 1; j <= jmax; j++){
           P[imax+1][j] = 2 * pr - P[imax][j];
       }
@@ -104,7 +79,7 @@ void sor(
       }
   }
 
-  if ( wt == boundary_condition["pressure"] ){
+  if ( wt == BC_PRESSURE ){
       for (i = 1; i <= imax; i++){
           P[i][jmax+1] = 2 * pt - P[i][jmax];
       }
@@ -115,7 +90,7 @@ void sor(
       }
   }
 
-  if ( wb == boundary_condition["pressure"] ){
+  if ( wb == BC_PRESSURE ){
       for (i = 1; i <= imax; i++){
           P[i][0] = 2 * pt - P[i][1];
       }
@@ -133,6 +108,253 @@ void sor(
     P[i][0] = P[i][1];
     P[i][jmax+1] = P[i][jmax];
   }
+}
+
+void sor(
+  double omg,
+  double dx,
+  double dy,
+  int    imax,
+  int    jmax,
+  Field2D<double> &P,
+  Field2D<double> &RS,
+  double *res,
+  CellLists const &cells,
+  int wl, int wr, int wt, int wb,// Use this to determine what kind of boundary we have
+  double pl, double pr, double pt, double pb,  // Pressures on the edges. Ignores if incorrect boundary type
+  int residual_mode,
+  double *sum
+) {
+  double diag  = 2.0*(1.0/(dx*dx)+1.0/(dy*dy));
+  double coeff = omg/diag;
+  double rloc  = 0;
+  double psum  = 0;
+
+  /* SOR iteration. The local residual is what the cell is relaxed with, so
+   * the fused residual comes for free. Every cell is updated once, so the
+   * sum of the new values is the sum of P after the sweep. */
+  for(size_t n = 0; n < cells.fluid.size(); n++) {
+    int i = cells.fluid[n].i;
+    for(int j = cells.fluid[n].jlow; j <= cells.fluid[n].jhigh; j++) {
+      double r = ( P[i+1][j]+P[i-1][j])/(dx*dx) + ( P[i][j+1]+P[i][j-1])/(dy*dy) - RS[i][j] - diag*P[i][j];
+      P[i][j] += coeff*r;
+      if (residual_mode == SOR_RESIDUAL_FUSED) {
+        rloc += r*r;
+      }
+      if (sum) {
+        psum += P[i][j];
+      }
+    }
+  }
+  if (sum) *sum = psum;
+
+  // Extra loop for obstacle boundaries
+  sor_obstacle_boundaries(P, cells);
+
+  /* compute the residual */
+  if (residual_mode == SOR_RESIDUAL_EXACT) {
+    *res = sor_residual(dx, dy, P, RS, cells);
+  }
+  else if (residual_mode == SOR_RESIDUAL_FUSED) {
+    *res = sqrt(rloc/cells.nof_fluid);
+  }
+
+  sor_domain_boundaries(imax, jmax, P, wl, wr, wt, wb, pl, pr, pt, pb);
+}
+
+// Returns the RMS of the local residuals the cells were relaxed with, and
+// the sum of P after the sweep in psum
+static double sor_redblack_sweep(
+  double omg,
+  double dx,
+  double dy,
+  int    imax,
+  int    jmax,
+  Field2D<double> &P,
+  Field2D<double> &RS,
+  CellLists const &cells,
+  double *psum
+) {
+  double diag  = 2.0*(1.0/(dx*dx)+1.0/(dy*dy));
+  double coeff = omg/diag;
+  double rloc  = 0;
+  double sum   = 0;
+
+  /* SOR iteration, first on the red cells (i+j even), then on the black
+   * ones (i+j odd). Cells of one colour only have neighbours of the other
+   * colour, hence each half sweep is free of dependencies. */
+  for (int colour = 0; colour <= 1; colour++) {
+    #pragma omp parallel for reduction(+:rloc,sum)
+    for(size_t n = 0; n < cells.fluid.size(); n++) {
+      int i    = cells.fluid[n].i;
+      int jlow = cells.fluid[n].jlow;
+      for(int j = jlow + ((i + jlow + colour) & 1); j <= cells.fluid[n].jhigh; j += 2) {
+        double r = ( P[i+1][j]+P[i-1][j])/(dx*dx) + ( P[i][j+1]+P[i][j-1])/(dy*dy) - RS[i][j] - diag*P[i][j];
+        P[i][j] += coeff*r;
+        rloc += r*r;
+        sum  += P[i][j];
+      }
+    }
+  }
+  *psum = sum;
+  return sqrt(rloc/cells.nof_fluid);
+}
+
+void sor_redblack(
+  double omg,
+  double dx,
+  double dy,
+  int    imax,
+  int    jmax,
+  Field2D<double> &P,
+  Field2D<double> &RS,
+  double *res,
+  CellLists const &cells,
+  int wl, int wr, int wt, int wb,
+  double pl, double pr, double pt, double pb,
+  int residual_mode,
+  double *sum
+) {
+  double psum;
+  double rfused = sor_redblack_sweep(omg, dx, dy, imax, jmax, P, RS, cells, &psum);
+  if (sum) *sum = psum;
+
+  // Extra loop for obstacle boundaries
+  sor_obstacle_boundaries(P, cells);
+
+  /* compute the residual */
+  if (residual_mode == SOR_RESIDUAL_EXACT) {
+    *res = sor_residual(dx, dy, P, RS, cells);
+  }
+  else if (residual_mode == SOR_RESIDUAL_FUSED) {
+    *res = rfused;
+  }
+
+  sor_domain_boundaries(imax, jmax, P, wl, wr, wt, wb, pl, pr, pt, pb);
+}
+
+
+// A change of omega is tried in four blocks of solves, alternating between
+// the new and the previous omega
+static unsigned int const omega_trial_block = 5;
+static int const omega_trial_order[4] = { 0, 1, 1, 0 };
+
+OmegaTuner::OmegaTuner(double omg, bool adaptive, double omg_max)
+  : omg(omg), adaptive(adaptive), omg_max(std::max(omg, omg_max)),
+    last_res(0), last_iteration(0), ratio(0), previous_ratio(0), nof_updates(0),
+    trial_solves(0), pause(4 * omega_trial_block), pause_length(4 * omega_trial_block)
+{
+  trial_omg[0]  = trial_omg[1]  = 0;
+  trial_cost[0] = trial_cost[1] = 0;
+}
+
+void OmegaTuner::residual(double res, unsigned int iteration)
+{
+  if (!adaptive) return;
+
+  if (last_res > 0 && res > 0 && iteration > last_iteration) {
+    previous_ratio = ratio;
+    ratio = pow(res / last_res, 1.0 / (iteration - last_iteration));
+  }
+  last_res       = res;
+  last_iteration = iteration;
+}
+
+void OmegaTuner::end_solve(bool converged, unsigned int iterations)
+{
+  if (!adaptive) return;
+
+  // A solve that stopped at itermax may be stuck at a residual it can't go
+  // below, e.g. when the right-hand side doesn't match the Neumann
+  // boundaries exactly. Its decay says nothing about the spectrum
+  double lambda = ratio;
+  bool settled  = converged && previous_ratio > 0 && fabs(lambda - previous_ratio) < 0.01 * (1 - lambda);
+
+  // A solve shorter than the decay time of the slowest mode is dominated by
+  // the high frequencies, which a smaller omega damps better
+  bool long_solve = last_iteration * (1 - lambda) >= 1;
+
+  last_res = 0;
+  last_iteration = 0;
+  ratio = previous_ratio = 0;
+
+  // During a trial the new and the previous omega take turns in the order
+  // new, previous, previous, new, which cancels a steady drift of the
+  // iterations. The first solve of each block inherits the error the other
+  // omega left behind and isn't counted. The new omega is kept if it needed
+  // fewer iterations, otherwise the next trial waits twice as long as the
+  // last one had to
+  if (trial_omg[0] > 0) {
+    if (trial_solves % omega_trial_block != 0) {
+      trial_cost[omega_trial_order[trial_solves / omega_trial_block]] += iterations;
+    }
+    if (++trial_solves < 4 * omega_trial_block) {
+      omg = trial_omg[omega_trial_order[trial_solves / omega_trial_block]];
+      return;
+    }
+
+    if (trial_cost[0] < trial_cost[1]) {
+      omg = trial_omg[0];
+      nof_updates++;
+    }
+    else {
+      omg = trial_omg[1];
+      pause = pause_length;
+      pause_length *= 2;
+    }
+    trial_omg[0]  = trial_omg[1]  = 0;
+    trial_cost[0] = trial_cost[1] = 0;
+    trial_solves  = 0;
+    return;
+  }
+  if (pause > 0) {
+    pause--;
+    return;
+  }
+
+  // Only the asymptotic decay tells something about the spectrum. lambda
+  // near omega - 1 means that omega is at or beyond the optimum, well below
+  // it that the solve was too short to show the slowest mode
+  if (!settled || !long_solve || lambda >= 1 || lambda < 0.95 * (omg - 1)) return;
+
+  double target;
+  if (lambda <= 1.05 * (omg - 1)) {
+    target = 1 + 0.9 * (omg - 1);
+  }
+  else {
+    double mu2 = (lambda + omg - 1) * (lambda + omg - 1) / (lambda * omg * omg);
+    if (mu2 >= 1) return;
 
+    // Half way only, as the optimum for the solves from a good start of
+    // a time step is usually below the estimate
+    target = 0.5 * (omg + 2 / (1 + sqrt(1 - mu2)));
+  }
+  target = std::min(target, omg_max);
+  if (fabs(target - omg) < 0.02) return;
+
+  trial_omg[0] = target;
+  trial_omg[1] = omg;
+  omg = target;
+}
+
+std::vector<double> OmegaTuner::state() const
+{
+  std::vector<double> values = { trial_omg[0], trial_omg[1], trial_cost[0], trial_cost[1],
+                                 (double)trial_solves, (double)pause, (double)pause_length,
+                                 (double)nof_updates };
+  return values;
 }
 
+void OmegaTuner::restore(std::vector<double> const &values)
+{
+  if (values.size() != 8) ERROR("Checkpoint doesn't match the omega tuner");
+
+  trial_omg[0]  = values[0];
+  trial_omg[1]  = values[1];
+  trial_cost[0] = values[2];
+  trial_cost[1] = values[3];
+  trial_solves  = values[4];
+  pause         = values[5];
+  pause_length  = values[6];
+  nof_updates   = values[7];
+}
@@ -1,12 +1,44 @@
 #ifndef __SOR_H_
 #define __SOR_H_
 
+#include "field2d.h"
+#include "cell_lists.h"
+#include <vector>
+
+// Method used to solve the pressure Poisson equation
+enum pressure_solver {
+    SOLVER_SOR       = 0,   // one SOR sweep per iteration
+    SOLVER_MULTIGRID = 1,   // one multigrid cycle per iteration
+    SOLVER_PCG       = 2,   // preconditioned conjugate gradients
+    SOLVER_FFT       = 3    // direct solve, only without obstacles
+};
+
+// Order in which the cells are visited during a SOR iteration
+enum sor_ordering {
+    SOR_LEXICOGRAPHIC = 0,  // row by row, strictly sequential
+    SOR_RED_BLACK     = 1   // checkerboard, each colour in parallel
+};
+
+// How the residual is obtained at the end of a SOR iteration
+enum sor_residual_mode {
+    SOR_RESIDUAL_SKIP  = 0, // leave res untouched
+    SOR_RESIDUAL_EXACT = 1, // extra pass over the grid after the sweep
+    SOR_RESIDUAL_FUSED = 2  // accumulated during the sweep, i.e. before each
+                            // cell was updated. Slightly larger, no extra pass
+};
+
 /**
  * One GS iteration for the pressure Poisson equation. Besides, the routine must 
  * also set the boundary values for P according to the specification. The 
  * residual for the termination criteria has to be stored in res.
  * 
  * An \omega = 1 GS - implementation is given within sor.c.
+ *
+ * residual_mode allows to skip the residual on iterations where it isn't
+ * checked anyway, or to take it from the sweep itself.
+ *
+ * If sum is given, the sum of P over the fluid cells after the sweep is
+ * stored there, so the mean can be removed without another pass.
  */
 void sor(
   double omg,
@@ -14,13 +46,122 @@ void sor(
   double dy,
   int    imax,
   int    jmax,
-  double **P,
-  double **RS,
+  Field2D<double> &P,
+  Field2D<double> &RS,
   double *res,
-  int    **Flag,
+  CellLists const &cells,
   int wl, int wr, int wt, int wb,// Use this to determine what kind of boundary we have
-  double pl, double pr, double pt, double pb   // Pressures on the edges. Ignores if incorrect boundary type
+  double pl, double pr, double pt, double pb,  // Pressures on the edges. Ignores if incorrect boundary type
+  int residual_mode = SOR_RESIDUAL_EXACT,
+  double *sum = 0
+);
+
+
+/**
+ * Same as sor(), but the fluid cells are relaxed in red-black (checkerboard)
+ * order: first all cells with i+j even, then all cells with i+j odd. Both
+ * half sweeps are split among OpenMP threads.
+ */
+void sor_redblack(
+  double omg,
+  double dx,
+  double dy,
+  int    imax,
+  int    jmax,
+  Field2D<double> &P,
+  Field2D<double> &RS,
+  double *res,
+  CellLists const &cells,
+  int wl, int wr, int wt, int wb,
+  double pl, double pr, double pt, double pb,
+  int residual_mode = SOR_RESIDUAL_EXACT,
+  double *sum = 0
 );
 
+/**
+ * Boundary values of the pressure as set at the end of every SOR iteration,
+ * for the other solvers:
+ *
+ * sor_obstacle_boundaries() sets obstacle boundary cells to the average of
+ *                           their fluid neighbours,
+ * sor_domain_boundaries()   sets the ghost layer according to wl,...,pb.
+ */
+void sor_obstacle_boundaries(Field2D<double> &P, CellLists const &cells);
+
+void sor_domain_boundaries(
+  int imax,
+  int jmax,
+  Field2D<double> &P,
+  int wl, int wr, int wt, int wb,
+  double pl, double pr, double pt, double pb
+);
+
+// Largest omega the tuner goes to unless <omega max="..."> sets another
+// bound. Close to 2 the iteration reacts strongly to any error in the
+// estimate
+#define SOR_OMEGA_MAX 1.99
+
+/**
+ * Relaxation factor of the SOR solvers, <omega adapt="true"> adapts it to
+ * the grid and the obstacles during the run.
+ *
+ * The residuals of a solve, passed to residual() whenever they are checked,
+ * decay by a factor lambda per iteration once the slowest mode dominates.
+ * For omega below the optimum this gives the spectral radius mu of the
+ * Jacobi iteration [Hageman, Young: Applied Iterative Methods, 9.3]:
+ *
+ * @f$ \mu^2 = (\lambda + \omega - 1)^2 / (\lambda \omega^2) @f$
+ *
+ * and end_solve() moves omega to the optimum 2 / (1 + sqrt(1 - mu^2)).
+ * Once omega has reached or passed it, lambda stays near omega - 1 and
+ * omega is lowered by a tenth of its distance to 1.
+ *
+ * The estimate only holds for long solves from a poor start. Every change
+ * is therefore tried first: the new and the previous omega take turns for
+ * a number of solves, and the one that needed fewer iterations is kept.
+ * After a change was turned down, omega stays on this side of the value
+ * it came from.
+ *
+ * With a fixed omega the tuner only hands it out.
+ */
+class OmegaTuner {
+    public:
+        OmegaTuner (double omg, bool adaptive, double omg_max = SOR_OMEGA_MAX);
+
+        double omega () const { return omg; }
+        void set_omega (double value) { omg = value; }
+
+        // The residual after the given number of iterations of the current
+        // solve. Iterations without a residual are skipped
+        void residual (double res, unsigned int iteration);
+
+        // Updates omega from the residuals of the solve if it converged, or
+        // the omega on trial by the iterations, restarts the record
+        void end_solve (bool converged, unsigned int iterations);
+
+        // Number of times omega was changed
+        unsigned int updates () const { return nof_updates; }
+
+        // What end_solve() carries from one solve to the next besides
+        // omega, to be stored in checkpoints
+        std::vector<double> state () const;
+        void restore (std::vector<double> const &values);
+
+    private:
+        double omg;
+        bool adaptive;
+        double omg_max;
+
+        double last_res;
+        unsigned int last_iteration;
+        double ratio, previous_ratio;   // decay per iteration between checks
+        unsigned int nof_updates;
+
+        double trial_omg[2];            // new and previous omega on trial, 0 if none
+        double trial_cost[2];           // iterations of the solves with each
+        unsigned int trial_solves;
+        unsigned int pause;             // solves until the next trial may start
+        unsigned int pause_length;      // after the next change turned down
+};
 
 #endif
@@ -0,0 +1,205 @@
+#include "steady_state.h"
+#include "Parameters.h"
+#include "helper.h"
+#include <math.h>
+#include <stdio.h>
+#include <float.h>
+#include <algorithm>
+
+
+SteadyStateMonitor::SteadyStateMonitor (Parameters const &params, CellLists const &cells, Field2D<int> const &Flag)
+    : params(params), cells(cells), previous_t(-1), next_check(0), last_change(DBL_MAX), why("")
+{
+    if (params.steady_tol > 0) {
+        for (unsigned int k = 0; k < 3 + params.nof_substances(); ++k) {
+            previous.push_back(Field2D<double>(params.imax, params.jmax));
+        }
+    }
+
+    for (size_t k = 0; k < params.probes.size(); ++k) {
+        signal_t s = {};
+        s.quantity = params.probes[k].quantity;
+        s.i = std::min(std::max((int)(params.probes[k].x / params.dx) + 1, 1), params.imax);
+        s.j = std::min(std::max((int)(params.probes[k].y / params.dy) + 1, 1), params.jmax);
+        if (!Flag[s.i][s.j]) ERROR("Probe inside an obstacle");
+        signals.push_back(s);
+    }
+}
+
+
+bool SteadyStateMonitor::update (double t, Field2D<double> const &U, Field2D<double> const &V,
+                                 Field2D<double> const &P, Field2D<double> const &T,
+                                 std::vector<Field2D<double> > const &C)
+{
+    // The probes are sampled every time step, even when the fields are not
+    // compared
+    bool is_periodic = periodic(t, U, V, P, T);
+
+    std::vector<Field2D<double> const *> fields;
+    fields.push_back(&U);
+    fields.push_back(&V);
+    fields.push_back(&T);
+    for (size_t s = 0; s < C.size(); ++s) fields.push_back(&C[s]);
+
+    if (steady(t, fields)) {
+        why = "steady";
+        return true;
+    }
+    if (is_periodic) {
+        why = "periodic";
+        return true;
+    }
+    return false;
+}
+
+
+bool SteadyStateMonitor::steady (double t, std::vector<Field2D<double> const *> const &fields)
+{
+    if (params.steady_tol <= 0 || t < next_check) return false;
+
+    bool settled = false;
+    if (previous_t >= 0) {
+        last_change = 0;
+        for (size_t k = 0; k < fields.size(); ++k) {
+            Field2D<double> const &X = *fields[k], &X_old = previous[k];
+
+            double diff = 0, scale = 0;
+            #pragma omp parallel for schedule(static) reduction(max:diff,scale)
+            for (size_t r = 0; r < cells.fluid.size(); ++r) {
+                int i = cells.fluid[r].i;
+                for (int j = cells.fluid[r].jlow; j <= cells.fluid[r].jhigh; ++j) {
+                    diff  = std::max(diff,  fabs(X[i][j] - X_old[i][j]));
+                    scale = std::max(scale, fabs(X[i][j]));
+                }
+            }
+            last_change = std::max(last_change, diff / std::max(scale, DBL_MIN) / (t - previous_t));
+        }
+        settled = (last_change < params.steady_tol);
+        printf("Currently at t = %f. Relative change %g per unit time\n", t, last_change);
+    }
+
+    for (size_t k = 0; k < fields.size(); ++k) previous[k].assign(*fields[k]);
+    previous_t = t;
+    next_check = t + params.steady_dt;
+
+    return settled;
+}
+
+
+bool SteadyStateMonitor::periodic (double t, Field2D<double> const &U, Field2D<double> const &V,
+                                   Field2D<double> const &P, Field2D<double> const &T)
+{
+    if (signals.empty()) return false;
+
+    bool settled = true;
+    for (size_t k = 0; k < signals.size(); ++k) {
+        signal_t &s = signals[k];
+
+        // Cell centred values, as in the VTK output
+        double v = 0;
+        switch (s.quantity) {
+            case PROBE_U: v = (U[s.i-1][s.j] + U[s.i][s.j]) / 2; break;
+            case PROBE_V: v = (V[s.i][s.j-1] + V[s.i][s.j]) / 2; break;
+            case PROBE_P: v = P[s.i][s.j]; break;
+            case PROBE_T: v = T[s.i][s.j]; break;
+        }
+
+        // The previous sample is a local maximum. Only maxima in the upper
+        // half of the range since the last peak count, so that a period with
+        // several maxima is not split up
+        if (s.samples >= 2 && s.value[1] > s.value[0] && s.value[1] >= v
+            && s.value[1] > (s.low + s.high) / 2) {
+            s.peak_t.push_back(s.time[1]);
+            s.peak_value.push_back(s.value[1]);
+            if (s.peak_t.size() > params.steady_periods + 1) {
+                s.peak_t.erase(s.peak_t.begin());
+                s.peak_value.erase(s.peak_value.begin());
+            }
+            s.low = s.high = s.value[1];
+        }
+        if (s.samples == 0) s.low = s.high = v;
+        s.low  = std::min(s.low, v);
+        s.high = std::max(s.high, v);
+
+        s.value[0] = s.value[1];  s.time[0] = s.time[1];
+        s.value[1] = v;           s.time[1] = t;
+        s.samples++;
+
+        if (s.peak_t.size() < params.steady_periods + 1) {
+            settled = false;
+            continue;
+        }
+
+        // Periods and peaks, each compared with their mean and largest value
+        double mean = (s.peak_t.back() - s.peak_t.front()) / params.steady_periods;
+        double low = *std::min_element(s.peak_value.begin(), s.peak_value.end());
+        double high = *std::max_element(s.peak_value.begin(), s.peak_value.end());
+        double scale = std::max(fabs(low), fabs(high));
+
+        for (unsigned int m = 0; m < params.steady_periods; ++m) {
+            double period = s.peak_t[m+1] - s.peak_t[m];
+            if (fabs(period - mean) > params.period_tol * mean) settled = false;
+        }
+        if (high - low > params.period_tol * scale) settled = false;
+    }
+
+    return settled;
+}
+
+
+std::vector<Field2D<double> *> SteadyStateMonitor::fields ()
+{
+    std::vector<Field2D<double> *> result;
+    for (size_t k = 0; k < previous.size(); ++k) result.push_back(&previous[k]);
+    return result;
+}
+
+
+// previous_t, next_check, last_change, then for every probe its last two
+// samples, range, sample count and peaks
+std::vector<double> SteadyStateMonitor::state () const
+{
+    std::vector<double> values;
+    values.push_back(previous_t);
+    values.push_back(next_check);
+    values.push_back(last_change);
+
+    for (size_t k = 0; k < signals.size(); ++k) {
+        signal_t const &s = signals[k];
+        values.push_back(s.value[0]);  values.push_back(s.value[1]);
+        values.push_back(s.time[0]);   values.push_back(s.time[1]);
+        values.push_back(s.low);       values.push_back(s.high);
+        values.push_back(s.samples);
+        values.push_back(s.peak_t.size());
+        values.insert(values.end(), s.peak_t.begin(), s.peak_t.end());
+        values.insert(values.end(), s.peak_value.begin(), s.peak_value.end());
+    }
+    return values;
+}
+
+
+void SteadyStateMonitor::restore (std::vector<double> const &values)
+{
+    size_t pos = 0;
+    if (values.size() < 3) ERROR("Checkpoint doesn't match the steady state monitor");
+    previous_t  = values[pos++];
+    next_check  = values[pos++];
+    last_change = values[pos++];
+
+    for (size_t k = 0; k < signals.size(); ++k) {
+        signal_t &s = signals[k];
+        if (values.size() < pos + 8) ERROR("Checkpoint doesn't match the steady state monitor");
+        s.value[0] = values[pos++];  s.value[1] = values[pos++];
+        s.time[0]  = values[pos++];  s.time[1]  = values[pos++];
+        s.low      = values[pos++];  s.high     = values[pos++];
+        s.samples  = (unsigned int)values[pos++];
+
+        size_t peaks = (size_t)values[pos++];
+        if (values.size() < pos + 2 * peaks) ERROR("Checkpoint doesn't match the steady state monitor");
+        s.peak_t.assign(values.begin() + pos, values.begin() + pos + peaks);
+        pos += peaks;
+        s.peak_value.assign(values.begin() + pos, values.begin() + pos + peaks);
+        pos += peaks;
+    }
+    if (pos != values.size()) ERROR("Checkpoint doesn't match the steady state monitor");
+}
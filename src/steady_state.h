@@ -0,0 +1,84 @@
+#ifndef STEADY_STATE_R5N8VJ2C
+#define STEADY_STATE_R5N8VJ2C
+
+#include "field2d.h"
+#include "cell_lists.h"
+#include <vector>
+
+// forward declaration
+class Parameters;
+
+// Quantity a probe records, <probe><quantity>
+enum probe_quantity {
+    PROBE_U = 0,
+    PROBE_V = 1,
+    PROBE_P = 2,
+    PROBE_T = 3
+};
+
+/**
+ * Tells when a run has settled, so the time loop can stop before t_end.
+ *
+ * Steady: every params.steady_dt, update() compares U, V, T and C with
+ * their copies from the previous check. The run is steady once the largest
+ * change of every field, relative to the largest absolute value of that
+ * field and per unit time, is below params.steady_tol.
+ *
+ * Periodic: update() samples the probes every time step and keeps one
+ * maximum per period of each signal. The run is periodic once the last
+ * params.steady_periods periods and peak values of every probe agree within
+ * params.period_tol.
+ *
+ * Without a <steady> block update() always returns false.
+ *
+ * A run restarted from a checkpoint continues with the state of the
+ * monitor at the time the checkpoint was written, so it stops at the same
+ * step as an uninterrupted run.
+ */
+class SteadyStateMonitor {
+    public:
+        SteadyStateMonitor (Parameters const &params, CellLists const &cells, Field2D<int> const &Flag);
+
+        // true once the run is steady or periodic, reason() tells which
+        bool update (double t, Field2D<double> const &U, Field2D<double> const &V,
+                     Field2D<double> const &P, Field2D<double> const &T,
+                     std::vector<Field2D<double> > const &C);
+
+        char const *reason () const { return why; }
+
+        // Largest relative change per unit time at the last check
+        double change () const { return last_change; }
+
+        // What update() carries from one call to the next, to be stored in
+        // checkpoints: the fields of the last comparison, and the check
+        // times and probe records as plain numbers
+        std::vector<Field2D<double> *> fields ();
+        std::vector<double> state () const;
+        void restore (std::vector<double> const &values);
+
+    private:
+        struct signal_t {
+            int quantity;
+            int i, j;                   // the cell sampled
+            double value[2], time[2];   // last two samples
+            double low, high;           // range since the last peak
+            unsigned int samples;
+            std::vector<double> peak_t, peak_value;
+        };
+
+        bool steady (double t, std::vector<Field2D<double> const *> const &fields);
+        bool periodic (double t, Field2D<double> const &U, Field2D<double> const &V,
+                       Field2D<double> const &P, Field2D<double> const &T);
+
+        Parameters const &params;
+        CellLists const &cells;
+
+        std::vector<Field2D<double> > previous;   // U, V, T, C at the last check
+        double previous_t, next_check;
+        double last_change;
+
+        std::vector<signal_t> signals;
+        char const *why;
+};
+
+#endif /* end of include guard: STEADY_STATE_R5N8VJ2C */
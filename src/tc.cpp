@@ -1,13 +1,14 @@
 #include "tc.h"
 #include "Parameters.h"
-#include "Range2.h"
-#include "matrix.h"
 #include "boundary_conditions.h"
 #include <math.h>
+#include <assert.h>
+#include <algorithm>
+#include <float.h>
 
 // Functions to approximate derivatives. From Griebels' book, page 133 eq. 9.21
 
-double uX_x(int i, int j, double **U, double **X, double dx, double gamma){
+double uX_x(int i, int j, Field2D<double> &U, Field2D<double> &X, double dx, double gamma){
     return 1 / ( 2 * dx ) * (
         ( U[i][j] * ( X[i][j] + X[i+1][j] )
         - U[i-1][j] * ( X[i-1][j] + X[i][j] ) )
@@ -17,7 +18,7 @@ double uX_x(int i, int j, double **U, double **X, double dx, double gamma){
       );
 }
 
-double vX_y(int i, int j, double **V, double **X, double dy, double gamma){
+double vX_y(int i, int j, Field2D<double> &V, Field2D<double> &X, double dy, double gamma){
     return 1 / ( 2 * dy ) * (
         ( V[i][j] * ( X[i][j] + X[i][j+1] )
         - V[i][j-1] * ( X[i][j-1] + X[i][j] ) )
@@ -27,97 +28,385 @@ double vX_y(int i, int j, double **V, double **X, double dy, double gamma){
       );
 }
 
-inline double X_xx(int i, int j, double **X, double dx){
+inline double X_xx(int i, int j, Field2D<double> &X, double dx){
     return (X[i+1][j] - 2*X[i][j] + X[i-1][j]) / (dx * dx);
 }
 
-inline double X_yy(int i, int j, double **X, double dy){
+inline double X_yy(int i, int j, Field2D<double> &X, double dy){
     return (X[i][j+1] - 2*X[i][j] + X[i][j-1]) / (dy * dy);
 }
 
-void calculate (Range2 const &idx_range, double **U, double **V, double **X, double **X_new, int **flag, Parameters const &parameters, double dt, double coeff, double production_coeff, int obstacle_type, double obstacle_value)
+// Obstacle cells next to the fluid get the average of what their neighbours
+// imply for the wall. type is a compile time constant, any other type than
+// Dirichlet or Neumann doesn't contribute.
+template <int type>
+static void obstacle_boundary (CellLists const &cells, Field2D<double> &X, Field2D<double> &X_new, Field2D<int> const &flag, double obstacle_value)
 {
-    for (int i = idx_range.i.low; i <= idx_range.i.high; ++i) {
-        for (int j = idx_range.j.low; j <= idx_range.j.high; ++j) {
-            // derived from [Gr98, 9.20]
+    for (int o = 1; o < 16; ++o) {
+        for (size_t n = 0; n < cells.boundary[o].size(); ++n) {
+            int i = cells.boundary[o][n].i;
+            int j = cells.boundary[o][n].j;
 
-            if (flag[i][j] & 16){ // This only for fluid cells
-                // We don't want to change T, so we write to another matrix
+            int counter = 0; // Counts the number of fluid cells around
+
+            // For the time being, only adiabatic boundaries if Neumann
+
+            // Always dealing with average, similar that with pressure
+            // but also working with Dirichlet boundaries
+
+            // Reset boundaries before adding
+            X_new[i][j] = 0;
+
+            // First check in vertical direction
+            for ( int l = -1; l <= 1; l++ ){
+                if ( flag[i][j+l] ){
+                    if ( type == BC_DIRICHLET ){ // If fixed temp
+                        X_new[i][j] += 2*obstacle_value - X[i][j+l];
+                    }
+                    else if ( type == BC_NEUMANN ){ // If isolation
+                        X_new[i][j] += X[i][j+l];
+                    }
+                    counter++;
+                }
+            }
+
+            // Then the horizontal direction
+            for ( int l = -1; l <= 1; l++ ){
+                if ( flag[i+l][j] ){
+                    if ( type == BC_DIRICHLET ){ // If fixed temp
+                        X_new[i][j] += 2*obstacle_value - X[i+l][j];
+                    }
+                    else if ( type == BC_NEUMANN ){ // If isolation
+                        X_new[i][j] += X[i+l][j];
+                    }
+                    counter++;
+                }
+            }
+
+            // Then average the whole thing
+            X_new[i][j] /= counter;
+        }
+    }
+}
+
+// Solves -r x[m-1] + (1 + 2r + e_m) x[m] - r x[m+1] = b[m], m = 0..n-1, with
+// the Thomas algorithm, e_0 = e_low, e_(n-1) = e_high and zero otherwise. x
+// holds b on entry
+static inline void thomas (double *x, int n, double r, double e_low, double e_high, double *cp)
+{
+    double d = 1 + 2 * r;
+    double d0 = d + e_low + (n == 1 ? e_high : 0);
+    cp[0] = -r / d0;
+    x[0]  = x[0] / d0;
+    for (int m = 1; m < n; ++m) {
+        double denom = d + (m == n - 1 ? e_high : 0) + r * cp[m-1];
+        cp[m] = -r / denom;
+        x[m]  = (x[m] + r * x[m-1]) / denom;
+    }
+    for (int m = n - 2; m >= 0; --m) {
+        x[m] -= cp[m] * x[m+1];
+    }
+}
+
+// The neighbour g of the cell x at the end of a line enters the implicit
+// solve through x: for Dirichlet boundaries g = s - x with the sum s of the
+// last step kept fixed, otherwise g = x + d with the difference d. Adds the
+// constant part to b and returns the change of the diagonal.
+static inline double line_end (int type, double g_old, double x_old, double r, double &b)
+{
+    if (type == BC_DIRICHLET) {
+        b += r * (g_old + x_old);
+        return r;
+    }
+    b += r * (g_old - x_old);
+    return -r;
+}
+
+// Implicit Euler step for the diffusion in X_new, which holds the explicitly
+// advected values of the fluid cells on entry. The 2D operator is split into
+// one tridiagonal solve per column and one per row of fluid cells, the lines
+// are independent and solved in parallel. The cells beyond the ends of a
+// line (obstacles and the domain boundary) keep the relation to their
+// neighbour of the last step, see line_end(). wall_type holds the boundary
+// types of the left, right, bottom and top wall.
+static void implicit_diffusion (CellLists const &cells, Field2D<double> const &X, Field2D<double> &X_new, Parameters const &parameters, double dt, double coeff, int const *wall_type, int obstacle_type)
+{
+    double rx = dt / (coeff * parameters.dx * parameters.dx);
+    double ry = dt / (coeff * parameters.dy * parameters.dy);
+    int imax = parameters.imax, jmax = parameters.jmax;
+
+    #pragma omp parallel
+    {
+        int length = std::max(imax, jmax);
+        std::vector<double> line(length), cp(length);
+
+        #pragma omp for schedule(static)
+        for (size_t c = 0; c < cells.fluid_columns.size(); ++c) {
+            int j = cells.fluid_columns[c].j, ilow = cells.fluid_columns[c].ilow, ihigh = cells.fluid_columns[c].ihigh;
+            int n = ihigh - ilow + 1;
+
+            for (int m = 0; m < n; ++m) line[m] = X_new[ilow + m][j];
+            double e_low  = line_end(ilow == 1     ? wall_type[0] : obstacle_type, X[ilow - 1][j],  X[ilow][j],  rx, line[0]);
+            double e_high = line_end(ihigh == imax ? wall_type[1] : obstacle_type, X[ihigh + 1][j], X[ihigh][j], rx, line[n-1]);
+            thomas(line.data(), n, rx, e_low, e_high, cp.data());
+            for (int m = 0; m < n; ++m) X_new[ilow + m][j] = line[m];
+        }
+
+        // X_new now differs from X, the rows take the old values from X
+        #pragma omp for schedule(static)
+        for (size_t r = 0; r < cells.fluid.size(); ++r) {
+            int i = cells.fluid[r].i, jlow = cells.fluid[r].jlow, jhigh = cells.fluid[r].jhigh;
+            int n = jhigh - jlow + 1;
+            double *x = X_new[i] + jlow;
+
+            double e_low  = line_end(jlow == 1     ? wall_type[2] : obstacle_type, X[i][jlow - 1],  X[i][jlow],  ry, x[0]);
+            double e_high = line_end(jhigh == jmax ? wall_type[3] : obstacle_type, X[i][jhigh + 1], X[i][jhigh], ry, x[n-1]);
+            thomas(x, n, ry, e_low, e_high, cp.data());
+        }
+    }
+}
+
+void calculate (CellLists const &cells, Field2D<double> &U, Field2D<double> &V, Field2D<double> &X, Field2D<double> &X_new, Field2D<int> const &flag, Parameters const &parameters, double dt, double coeff, double production_coeff, int const *wall_type, int obstacle_type, double obstacle_value)
+{
+    bool implicit = (parameters.diffusion == DIFFUSION_ADI);
+
+    // derived from [Gr98, 9.20], only for fluid cells
+    #pragma omp parallel for schedule(static)
+    for (size_t r = 0; r < cells.fluid.size(); ++r) {
+        int i = cells.fluid[r].i;
+        for (int j = cells.fluid[r].jlow; j <= cells.fluid[r].jhigh; ++j) {
+            // We don't want to change T, so we write to another matrix
+            if (implicit) {
                 X_new[i][j] = X[i][j] + dt * (
                         - uX_x(i, j, U, X, parameters.dx, parameters.gamma)
                         - vX_y(i, j, V, X, parameters.dy, parameters.gamma)
-                        + (X_xx(i, j, X, parameters.dx) + X_yy(i, j, X, parameters.dy)) / coeff
                         );
+                continue;
             }
+            X_new[i][j] = X[i][j] + dt * (
+                    - uX_x(i, j, U, X, parameters.dx, parameters.gamma)
+                    - vX_y(i, j, V, X, parameters.dy, parameters.gamma)
+                    + (X_xx(i, j, X, parameters.dx) + X_yy(i, j, X, parameters.dy)) / coeff
+                    );
+        }
+    }
 
-            // Else, if boundary obstacle
-            else if ( !(flag[i][j] & 16) && flag[i][j] ){
+    if (implicit) implicit_diffusion(cells, X, X_new, parameters, dt, coeff, wall_type, obstacle_type);
 
-                int counter = 0; // Counts the number of fluid cells around
+    // Boundary obstacles, the type is resolved here once instead of for
+    // every neighbour
+    switch (obstacle_type) {
+        case BC_DIRICHLET: obstacle_boundary<BC_DIRICHLET>(cells, X, X_new, flag, obstacle_value); break;
+        case BC_NEUMANN:   obstacle_boundary<BC_NEUMANN>  (cells, X, X_new, flag, obstacle_value); break;
+        default:           obstacle_boundary<-1>          (cells, X, X_new, flag, obstacle_value); break;
+    }
 
-                // For the time being, only adiabatic boundaries if Neumann
+    // Inner obstacles. Set them to given temperature
+    // This doesn't make sense with Neumann boundaries, but whatever
+    for (size_t n = 0; n < cells.solid.size(); ++n) {
+        X_new[cells.solid[n].i][cells.solid[n].j] = obstacle_value;
+    }
+}
 
-                // Always dealing with average, similar that with pressure
-                // but also working with Dirichlet boundaries
+void calculate_next_T (CellLists const &cells, Field2D<double> &U, Field2D<double> &V, Field2D<double> &T, Field2D<double> &T_new, Field2D<int> const &flag, const Parameters & parameters, double dt)
+{
+    int walls[4] = { parameters.wlt, parameters.wrt, parameters.wbt, parameters.wtt };
+    calculate (cells, U, V, T, T_new, flag, parameters, dt, parameters.Re * parameters.Pr, 1, walls, parameters.otype, parameters.oterm);
 
-                // Reset boundaries before adding
-                X_new[i][j] = 0;
+    // Swap matrices
+    T.swap(T_new);
+}
 
-                // First check in vertical direction
-                for ( int l = -1; l <= 1; l++ ){
-                    if ( flag[i][j+l] ){
-                        if ( obstacle_type == boundary_condition["dirichlet"] ){ // If fixed temp
-                            X_new[i][j] += 2*obstacle_value - X[i][j+l];
-                        }
-                        else if ( obstacle_type == boundary_condition["neumann"] ){ // If isolation
-                            X_new[i][j] += X[i][j+l];
-                        }
-                        counter++;
-                    }
-                }
+// The walls of the domain for the substances, see boundary_val.cpp
+static const int neumann_walls[4] = { BC_NEUMANN, BC_NEUMANN, BC_NEUMANN, BC_NEUMANN };
 
-                // Then the horizontal direction
-                for ( int l = -1; l <= 1; l++ ){
-                    if ( flag[i+l][j] ){
-                        if ( obstacle_type == boundary_condition["dirichlet"] ){ // If fixed temp
-                            X_new[i][j] += 2*obstacle_value - X[i+l][j];
-                        }
-                        else if ( obstacle_type == boundary_condition["neumann"] ){ // If isolation
-                            X_new[i][j] += X[i+l][j];
-                        }
-                        counter++;
-                    }
+void calculate_next_C (CellLists const &cells, Field2D<double> &U, Field2D<double> &V, std::vector<Field2D<double> > &C, Field2D<double> &C_new, Field2D<int> const &flag, Parameters const &parameters, double dt)
+{
+    // TODO get the arguments right: coefficient
+    for (unsigned int s = 0; s < parameters.nof_substances(); ++s) {
+        calculate (cells, U, V, C[s], C_new, flag, parameters,
+                dt, 1 / (parameters.substance[s].lambda), 1,
+                neumann_walls, BC_NEUMANN, 0);
+        C[s].swap(C_new);
+    }
+}
+
+// Velocities around the cells of a run, loaded once for all scalars
+struct run_velocities_t {
+    std::vector<double> ue, uw, ve, vs;     // U[i][j], U[i-1][j], V[i][j], V[i][j-1]
+    std::vector<double> aue, auw, ave, avs; // their absolute values
+
+    void resize (size_t n)
+    {
+        ue.resize(n);  uw.resize(n);  ve.resize(n);  vs.resize(n);
+        aue.resize(n); auw.resize(n); ave.resize(n); avs.resize(n);
+    }
+};
+
+void calculate_next_scalars (CellLists const &cells, Field2D<double> &U, Field2D<double> &V, Field2D<double> *T, std::vector<Field2D<double> > &C, std::vector<Field2D<double> > &X_new, Field2D<int> const &flag, Parameters const &parameters, double dt)
+{
+    std::vector<double> dts(parameters.nof_substances() + (T ? 1 : 0), dt);
+    calculate_next_scalars(cells, U, V, T, C, X_new, flag, parameters, dts);
+}
+
+void calculate_next_scalars (CellLists const &cells, Field2D<double> &U, Field2D<double> &V, Field2D<double> *T, std::vector<Field2D<double> > &C, std::vector<Field2D<double> > &X_new, Field2D<int> const &flag, Parameters const &parameters, std::vector<double> const &dt)
+{
+    // The substances followed by the temperature, with the arguments
+    // calculate_next_C() and calculate_next_T() pass to calculate()
+    std::vector<Field2D<double> *> X;
+    std::vector<double> coeff, obstacle_value;
+    std::vector<int> obstacle_type;
+    for (unsigned int s = 0; s < parameters.nof_substances(); ++s) {
+        X.push_back(&C[s]);
+        coeff.push_back(1 / (parameters.substance[s].lambda));
+        obstacle_type.push_back(BC_NEUMANN);
+        obstacle_value.push_back(0);
+    }
+    if (T) {
+        X.push_back(T);
+        coeff.push_back(parameters.Re * parameters.Pr);
+        obstacle_type.push_back(parameters.otype);
+        obstacle_value.push_back(parameters.oterm);
+    }
+    size_t nX = X.size();
+    assert(X_new.size() >= nX);
+    assert(dt.size() >= nX);
+
+    double dx = parameters.dx, dy = parameters.dy, gamma = parameters.gamma;
+    bool implicit = (parameters.diffusion == DIFFUSION_ADI);
+
+    // derived from [Gr98, 9.20], only for fluid cells. Same arithmetic as
+    // calculate(), but U and V are read once per run for all scalars and the
+    // loops over j vectorise
+    #pragma omp parallel
+    {
+        run_velocities_t vel;
+        vel.resize(parameters.jmax + 1);
+
+        #pragma omp for schedule(static)
+        for (size_t r = 0; r < cells.fluid.size(); ++r) {
+            int i = cells.fluid[r].i;
+            int jlow = cells.fluid[r].jlow, n = cells.fluid[r].jhigh - jlow + 1;
+
+            double const *u = U[i] + jlow, *uw = U[i-1] + jlow;
+            double const *v = V[i] + jlow, *vs = V[i] + jlow - 1;
+            for (int m = 0; m < n; ++m) {
+                vel.ue[m]  = u[m];        vel.uw[m]  = uw[m];
+                vel.ve[m]  = v[m];        vel.vs[m]  = vs[m];
+                vel.aue[m] = fabs(u[m]);  vel.auw[m] = fabs(uw[m]);
+                vel.ave[m] = fabs(v[m]);  vel.avs[m] = fabs(vs[m]);
+            }
+
+            for (size_t k = 0; k < nX; ++k) {
+                if (dt[k] <= 0) continue;
+                Field2D<double> &Xk = *X[k];
+                double const *xc = Xk[i] + jlow, *xe = Xk[i+1] + jlow, *xw = Xk[i-1] + jlow;
+                double *xn = X_new[k][i] + jlow;
+                double ck = coeff[k], dtk = dt[k];
+
+                for (int m = 0; m < n; ++m) {
+                    double ux = 1 / ( 2 * dx ) * (
+                        ( vel.ue[m] * ( xc[m] + xe[m] )
+                        - vel.uw[m] * ( xw[m] + xc[m] ) )
+                        + gamma *
+                        ( vel.aue[m] * ( xc[m] - xe[m] )
+                        - vel.auw[m] * ( xw[m] - xc[m] ) )
+                      );
+                    double vy = 1 / ( 2 * dy ) * (
+                        ( vel.ve[m] * ( xc[m] + xc[m+1] )
+                        - vel.vs[m] * ( xc[m-1] + xc[m] ) )
+                        + gamma *
+                        ( vel.ave[m] * ( xc[m] - xc[m+1] )
+                        - vel.avs[m] * ( xc[m-1] - xc[m] ) )
+                      );
+                    double xx = (xe[m] - 2*xc[m] + xw[m]) / (dx * dx);
+                    double yy = (xc[m+1] - 2*xc[m] + xc[m-1]) / (dy * dy);
+
+                    xn[m] = implicit
+                        ? xc[m] + dtk * ( - ux - vy )
+                        : xc[m] + dtk * ( - ux - vy + (xx + yy) / ck );
                 }
+            }
+        }
+    }
+
+    if (implicit) {
+        int T_walls[4] = { parameters.wlt, parameters.wrt, parameters.wbt, parameters.wtt };
+        for (size_t k = 0; k < nX; ++k) {
+            if (dt[k] <= 0) continue;
+            implicit_diffusion(cells, *X[k], X_new[k], parameters, dt[k], coeff[k],
+                               k < parameters.nof_substances() ? neumann_walls : T_walls, obstacle_type[k]);
+        }
+    }
 
-                // Then average the whole thing
-                X_new[i][j] /= counter;
+    // Boundary obstacles, the fluid neighbours are looked up once for all
+    // scalars. Summed in the same order as obstacle_boundary()
+    for (int o = 1; o < 16; ++o) {
+        for (size_t b = 0; b < cells.boundary[o].size(); ++b) {
+            int i = cells.boundary[o][b].i;
+            int j = cells.boundary[o][b].j;
 
+            int di[6], dj[6], counter = 0;
+            for (int l = -1; l <= 1; l++) {
+                if (flag[i][j+l]) { di[counter] = 0; dj[counter] = l; counter++; }
+            }
+            for (int l = -1; l <= 1; l++) {
+                if (flag[i+l][j]) { di[counter] = l; dj[counter] = 0; counter++; }
             }
 
-            // Else, inner boundary. Set it to given temperature
-            // This doesn't make sense with Neumann boundaries, but whatever
-            else {
-                X_new[i][j] = obstacle_value;
+            for (size_t k = 0; k < nX; ++k) {
+                if (dt[k] <= 0) continue;
+                Field2D<double> &Xk = *X[k];
+                double sum = 0;
+                for (int c = 0; c < counter; ++c) {
+                    if (obstacle_type[k] == BC_DIRICHLET) sum += 2*obstacle_value[k] - Xk[i+di[c]][j+dj[c]];
+                    else if (obstacle_type[k] == BC_NEUMANN) sum += Xk[i+di[c]][j+dj[c]];
+                }
+                X_new[k][i][j] = sum / counter;
             }
         }
     }
+
+    // Inner obstacles. Set them to given value
+    for (size_t n = 0; n < cells.solid.size(); ++n) {
+        for (size_t k = 0; k < nX; ++k) {
+            if (dt[k] > 0) X_new[k][cells.solid[n].i][cells.solid[n].j] = obstacle_value[k];
+        }
+    }
+
+    for (size_t k = 0; k < nX; ++k) {
+        if (dt[k] > 0) X[k]->swap(X_new[k]);
+    }
 }
 
-void calculate_next_T (Range2 const &idx_range, double **U, double **V, double ***T, double ***T_new, int **flag, const Parameters & parameters, double dt)
+std::vector<double> scalar_max_dt (Parameters const &parameters)
 {
-    calculate (idx_range, U, V, *T, *T_new, flag, parameters, dt, parameters.Re * parameters.Pr, 1, parameters.otype, parameters.oterm);
+    std::vector<double> max_dt;
 
-    // Swap matrices
-    swap2(T, T_new);
+    // Implicit diffusion is stable for any time step
+    bool implicit = (parameters.diffusion == DIFFUSION_ADI);
+    double h = 1/pow(parameters.dx, 2) + 1/pow(parameters.dy, 2);
+
+    // Stability condition for substance diffusion
+    for (unsigned int s = 0; s < parameters.nof_substances(); ++s) {
+        max_dt.push_back(implicit ? DBL_MAX : 1 / ( 2 * parameters.substance[s].lambda * h ));
+    }
+
+    // Stability condition for energy transport
+    max_dt.push_back(implicit ? DBL_MAX : parameters.Re*parameters.Pr/2 / h);
+
+    return max_dt;
 }
 
-void calculate_next_C (Range2 const &idx_range, double **U, double **V, double ***C,  double ***C_new, int **flag, Parameters const &parameters, double dt)
+std::vector<unsigned int> scalar_substeps (Parameters const &parameters, double dt)
 {
-    // TODO get the arguments right: coefficient
-    for (unsigned int s = 0; s < parameters.nof_substances(); ++s) {
-        calculate (idx_range, U, V, C[s], *C_new, flag, parameters,
-                dt, 1 / (parameters.substance[s].lambda), 1,
-                boundary_condition["neumann"], 0);
-        swap2(&(C[s]), C_new);
+    std::vector<double> max_dt = scalar_max_dt(parameters);
+    double tau = (parameters.tau > 0) ? parameters.tau : 1;
+
+    std::vector<unsigned int> steps;
+    for (size_t k = 0; k < max_dt.size(); ++k) {
+        double n = ceil(dt / (tau * max_dt[k]));
+        steps.push_back((unsigned int) std::max(1.0, std::min(n, (double) parameters.transport_subcycles)));
     }
+    return steps;
 }
@@ -1,13 +1,43 @@
 #ifndef __TC_H_
 #define __TC_H_
 
-#include "Range2.h"
+#include "field2d.h"
+#include "cell_lists.h"
+#include <vector>
 
-class Range2;
 class Parameters;
 
-void calculate_next_T (Range2 const &idx_range, double **U, double **V, double ***T, double ***T_new, int **flag, const Parameters & parameters, double dt);
+// How the diffusion of temperature and substances is discretised in time
+enum diffusion_scheme {
+    DIFFUSION_EXPLICIT = 0, // explicit Euler, limits the time step size
+    DIFFUSION_ADI      = 1  // implicit Euler, one tridiagonal solve per
+                            // column and per row of fluid cells
+};
 
-void calculate_next_C (Range2 const &idx_range, double **U, double **V, double ***C,  double ***C_new, int **flag, const Parameters & parameters, double dt);
+// T_new is used as scratch space and swapped with T (or C[s]) afterwards
+void calculate_next_T (CellLists const &cells, Field2D<double> &U, Field2D<double> &V, Field2D<double> &T, Field2D<double> &T_new, Field2D<int> const &flag, const Parameters & parameters, double dt);
+
+void calculate_next_C (CellLists const &cells, Field2D<double> &U, Field2D<double> &V, std::vector<Field2D<double> > &C, Field2D<double> &C_new, Field2D<int> const &flag, const Parameters & parameters, double dt);
+
+/**
+ * Transport of all substances and, if T is given, of the temperature in a
+ * single sweep. Gives the same results as calculate_next_C() followed by
+ * calculate_next_T(), but reads U, V and the flags once instead of once per
+ * scalar. X_new holds at least one scratch field per scalar, substances
+ * first; each is swapped with its scalar afterwards.
+ */
+void calculate_next_scalars (CellLists const &cells, Field2D<double> &U, Field2D<double> &V, Field2D<double> *T, std::vector<Field2D<double> > &C, std::vector<Field2D<double> > &X_new, Field2D<int> const &flag, const Parameters & parameters, double dt);
+
+// As above, but every scalar advances by its own step size dt[k] (substances
+// first). Scalars with dt[k] <= 0 are left as they are
+void calculate_next_scalars (CellLists const &cells, Field2D<double> &U, Field2D<double> &V, Field2D<double> *T, std::vector<Field2D<double> > &C, std::vector<Field2D<double> > &X_new, Field2D<int> const &flag, const Parameters & parameters, std::vector<double> const &dt);
+
+// Largest stable explicit step of every substance and of the temperature,
+// without the safety factor tau. DBL_MAX with implicit diffusion
+std::vector<double> scalar_max_dt (const Parameters & parameters);
+
+// Number of sub-steps each scalar needs to cover the time step dt with the
+// velocities frozen, at most transport_subcycles
+std::vector<unsigned int> scalar_substeps (const Parameters & parameters, double dt);
 
 #endif
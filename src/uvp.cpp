@@ -1,7 +1,11 @@
 #include "uvp.h"
 #include "Parameters.h"
 #include "helper.h"
+#include "tc.h"
 #include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 /**
  * Determines the value of U and G according to the formula
@@ -27,65 +31,82 @@
 
 // Put these signatures here to keep the header untouched
 
-double du2dx(int i, int j, double **U, double **V, double dx, double dy, double alpha);
-double duvdy(int i, int j, double **U, double **V, double dx, double dy, double alpha);
-double duvdx(int i, int j, double **U, double **V, double dx, double dy, double alpha);
-double dv2dy(int i, int j, double **U, double **V, double dx, double dy, double alpha);
+double du2dx(int i, int j, Field2D<double> &U, Field2D<double> &V, double dx, double dy, double alpha);
+double duvdy(int i, int j, Field2D<double> &U, Field2D<double> &V, double dx, double dy, double alpha);
+double duvdx(int i, int j, Field2D<double> &U, Field2D<double> &V, double dx, double dy, double alpha);
+double dv2dy(int i, int j, Field2D<double> &U, Field2D<double> &V, double dx, double dy, double alpha);
+
+// F and G of a single face, (9) and (10)
+static inline double f_value(const Parameters & parameters, Field2D<double> &U, Field2D<double> &V, Field2D<double> &T, int i, int j, double dt)
+{
+    return U[i][j]
+        + dt * (
+                1 / parameters.Re * (
+                    ( U[i+1][j] - 2 * U[i][j] + U[i-1][j] ) / (parameters.dx * parameters.dx) +
+                    ( U[i][j+1] - 2 * U[i][j] + U[i][j-1] ) / (parameters.dy * parameters.dy) )
+                - du2dx(i, j, U, V, parameters.dx, parameters.dy, parameters.alpha)
+                - duvdy(i, j, U, V, parameters.dx, parameters.dy, parameters.alpha)
+                + parameters.GX * (1 - parameters.beta / 2) * (T[i][j] + T[i+1][j])
+               );
+}
+
+static inline double g_value(const Parameters & parameters, Field2D<double> &U, Field2D<double> &V, Field2D<double> &T, int i, int j, double dt)
+{
+    return V[i][j]
+        + dt * (
+                1 / parameters.Re * (
+                    ( V[i+1][j] - 2 * V[i][j] + V[i-1][j] ) / (parameters.dx * parameters.dx) +
+                    ( V[i][j+1] - 2 * V[i][j] + V[i][j-1] ) / (parameters.dy * parameters.dy) )
+                - dv2dy(i, j, U, V, parameters.dx, parameters.dy, parameters.alpha)
+                - duvdx(i, j, U, V, parameters.dx, parameters.dy, parameters.alpha)
+                + parameters.GY * (1 - parameters.beta / 2) * (T[i][j] + T[i][j+1])
+               );
+}
+
+// Boundary conditions for F and G at the domain edges
+static void fg_edges(const Parameters & parameters, Field2D<double> &U, Field2D<double> &V, Field2D<double> &F, Field2D<double> &G)
+{
+    for (int j = 1; j <= parameters.jmax; ++j) {
+        F[0][j] = U[0][j];
+        F[parameters.imax][j] = U[parameters.imax][j];
+    }
+    for (int i = 1; i <= parameters.imax; ++i) {
+        G[i][0] = V[i][0];
+        G[i][parameters.jmax] = V[i][parameters.jmax];
+    }
+}
 
 void calculate_fg(
   const Parameters & parameters,
-  double **U,
-  double **V,
-  double **T,
-  double **F,
-  double **G,
-  int **Flag,
+  Field2D<double> &U,
+  Field2D<double> &V,
+  Field2D<double> &T,
+  Field2D<double> &F,
+  Field2D<double> &G,
+  CellLists const &cells,
   double dt
 ){
     /* Compute the rest of the values */
-    for (int i = 1; i <= parameters.imax; ++i){
-        for (int j = 1; j <= parameters.jmax; ++j){
-
-            if ( Flag[i][j] & 16 ){ // If we have a fluid cell
-                if ( Flag[i+1][j] & 16 ){ // If the following cell in x is fluid
-                    F[i][j] =
-                        U[i][j]
-                        + dt * (
-                                1 / parameters.Re * (
-                                    ( U[i+1][j] - 2 * U[i][j] + U[i-1][j] ) / (parameters.dx * parameters.dx) +
-                                    ( U[i][j+1] - 2 * U[i][j] + U[i][j-1] ) / (parameters.dy * parameters.dy) )
-                                - du2dx(i, j, U, V, parameters.dx, parameters.dy, parameters.alpha)
-                                - duvdy(i, j, U, V, parameters.dx, parameters.dy, parameters.alpha)
-                                + parameters.GX * (1 - parameters.beta / 2) * (T[i][j] + T[i+1][j])
-                               );
-                }
-
+    // F between two fluid cells in x direction
+    #pragma omp parallel for schedule(static)
+    for (size_t r = 0; r < cells.u_faces.size(); ++r){
+        int i = cells.u_faces[r].i;
+        for (int j = cells.u_faces[r].jlow; j <= cells.u_faces[r].jhigh; ++j){
+            F[i][j] = f_value(parameters, U, V, T, i, j, dt);
+        }
+    }
 
-                if ( Flag[i][j+1] & 16 ){
-                    G[i][j] =
-                        V[i][j]
-                        + dt * (
-                                1 / parameters.Re * (
-                                    ( V[i+1][j] - 2 * V[i][j] + V[i-1][j] ) / (parameters.dx * parameters.dx) +
-                                    ( V[i][j+1] - 2 * V[i][j] + V[i][j-1] ) / (parameters.dy * parameters.dy) )
-                                - dv2dy(i, j, U, V, parameters.dx, parameters.dy, parameters.alpha)
-                                - duvdx(i, j, U, V, parameters.dx, parameters.dy, parameters.alpha)
-                                + parameters.GY * (1 - parameters.beta / 2) * (T[i][j] + T[i][j+1])
-                               );
-                }
-            }
+    // G between two fluid cells in y direction
+    #pragma omp parallel for schedule(static)
+    for (size_t r = 0; r < cells.v_faces.size(); ++r){
+        int i = cells.v_faces[r].i;
+        for (int j = cells.v_faces[r].jlow; j <= cells.v_faces[r].jhigh; ++j){
+            G[i][j] = g_value(parameters, U, V, T, i, j, dt);
         }
     }
 
     /* Boundary conditions for F and G */
-    for (int j = 1; j <= parameters.jmax; ++j) {
-        F[0][j] = U[0][j];
-        F[parameters.imax][j] = U[parameters.imax][j];
-    }
-    for (int i = 1; i <= parameters.imax; ++i) {
-        G[i][0] = V[i][0];
-        G[i][parameters.jmax] = V[i][parameters.jmax];
-    }
+    fg_edges(parameters, U, V, F, G);
 }
 
 
@@ -102,19 +123,95 @@ void calculate_rs(
   double dy,
   int imax,
   int jmax,
-  double **F,
-  double **G,
-  double **RS,
-  int **Flag
+  Field2D<double> &F,
+  Field2D<double> &G,
+  Field2D<double> &RS,
+  CellLists const &cells
+){
+    #pragma omp parallel for schedule(static)
+    for (size_t r = 0; r < cells.fluid.size(); ++r){
+        int i = cells.fluid[r].i;
+        for (int j = cells.fluid[r].jlow; j <= cells.fluid[r].jhigh; ++j){
+            RS[i][j] = 1 / dt * (
+                      ( F[i][j] - F[i-1][j] ) / dx
+                    + ( G[i][j] - G[i][j-1] ) / dy
+                );
+        }
+    }
+}
+
+
+// F of row i as calculate_fg() leaves it, into a row of the calling thread
+static void f_row_copy(const Parameters & parameters, Field2D<double> &U, Field2D<double> &V, Field2D<double> &T, Field2D<double> &F, CellLists const &cells, double dt, int i, std::vector<double> &row)
+{
+    int j = 0;
+    for (size_t r = cells.u_faces_row[i]; r < cells.u_faces_row[i+1]; ++r){
+        for (; j < cells.u_faces[r].jlow; ++j) row[j] = F[i][j];
+        for (; j <= cells.u_faces[r].jhigh; ++j) row[j] = f_value(parameters, U, V, T, i, j, dt);
+    }
+    for (; j <= parameters.jmax + 1; ++j) row[j] = F[i][j];
+}
+
+void calculate_fg_rs(
+  const Parameters & parameters,
+  Field2D<double> &U,
+  Field2D<double> &V,
+  Field2D<double> &T,
+  Field2D<double> &F,
+  Field2D<double> &G,
+  Field2D<double> &RS,
+  CellLists const &cells,
+  double dt
 ){
-    for (int i = 1; i <= imax; ++i){
-        for (int j = 1; j <= jmax; ++j){
-            if (Flag[i][j] & 16){ // If the cell is fluid
-                RS[i][j] = 1 / dt * (
-                          ( F[i][j] - F[i-1][j] ) / dx
-                        + ( G[i][j] - G[i][j-1] ) / dy
-                    );
+    double dx = parameters.dx, dy = parameters.dy;
+
+    // The edges only depend on U and V and are read by the first and last
+    // RS of every row and column
+    fg_edges(parameters, U, V, F, G);
+
+    #pragma omp parallel
+    {
+#ifdef _OPENMP
+        int nthreads = omp_get_num_threads(), id = omp_get_thread_num();
+#else
+        int nthreads = 1, id = 0;
+#endif
+        // Contiguous block of rows per thread
+        int ilow  = 1 + (int)((long)parameters.imax * id / nthreads);
+        int ihigh = (int)((long)parameters.imax * (id + 1) / nthreads);
+
+        // F of the row before the block belongs to the previous thread, which
+        // may not have got to it yet. The halo is that row computed once more
+        std::vector<double> halo;
+        double const *F_west = F[ilow-1];
+        if (ilow > 1 && ilow <= ihigh) {
+            halo.resize(parameters.jmax + 2);
+            f_row_copy(parameters, U, V, T, F, cells, dt, ilow - 1, halo);
+            F_west = halo.data();
+        }
+
+        for (int i = ilow; i <= ihigh; ++i) {
+            for (size_t r = cells.u_faces_row[i]; r < cells.u_faces_row[i+1]; ++r){
+                for (int j = cells.u_faces[r].jlow; j <= cells.u_faces[r].jhigh; ++j){
+                    F[i][j] = f_value(parameters, U, V, T, i, j, dt);
+                }
+            }
+            for (size_t r = cells.v_faces_row[i]; r < cells.v_faces_row[i+1]; ++r){
+                for (int j = cells.v_faces[r].jlow; j <= cells.v_faces[r].jhigh; ++j){
+                    G[i][j] = g_value(parameters, U, V, T, i, j, dt);
+                }
+            }
+
+            // F and G of the row are still in cache
+            for (size_t r = cells.fluid_row[i]; r < cells.fluid_row[i+1]; ++r){
+                for (int j = cells.fluid[r].jlow; j <= cells.fluid[r].jhigh; ++j){
+                    RS[i][j] = 1 / dt * (
+                              ( F[i][j] - F_west[j] ) / dx
+                            + ( G[i][j] - G[i][j-1] ) / dy
+                        );
+                }
             }
+            F_west = F[i];
         }
     }
 }
@@ -131,26 +228,27 @@ void calculate_rs(
 void calculate_dt(
   const Parameters & parameters,
   double *dt,
-  double **U,
-  double **V,
-  double **T,
-  double ***C,
-  int **Flag,
-  std::vector<double> & rates
+  Field2D<double> &U,
+  Field2D<double> &V,
+  std::vector<Field2D<double> > const &C,
+  std::vector<Field2D<double> > const &R,
+  CellLists const &cells
 ) {
     /* STEP 1
      * Calculate the minimum absolute values of U_ij and V_ij
      * with i = [0..imax+1], j = [0..jmax+1] i.e. including boundaries.
      */
 
-    // initial maximum values are initialized to be the first elements of U,V
-    double umax = fabs(**U),
-           vmax = fabs(**V);
+    double umax = 0,
+           vmax = 0;
 
     // sweep matrix, searching for larger elements
-    for (int i = 1; i < (parameters.imax + 2) * (parameters.jmax + 2); ++i) {
-        if (fabs(*(*U+i)) > umax)   umax = fabs(*(*U+i));
-        if (fabs(*(*V+i)) > vmax)   vmax = fabs(*(*V+i));
+    #pragma omp parallel for schedule(static) reduction(max:umax,vmax)
+    for (int i = 0; i <= parameters.imax + 1; ++i) {
+        for (int j = 0; j <= parameters.jmax + 1; ++j) {
+            if (fabs(U[i][j]) > umax)   umax = fabs(U[i][j]);
+            if (fabs(V[i][j]) > vmax)   vmax = fabs(V[i][j]);
+        }
     }
 
 
@@ -169,18 +267,17 @@ void calculate_dt(
     // analogously for c3:
     possible_dt.push_back((vmax <= 0) ? DBL_MAX : parameters.dy / fabs(vmax));
 
-    // Stability condition for energy transport
-    possible_dt.push_back(parameters.Re*parameters.Pr/2 / ( 1/pow(parameters.dx, 2) + 1/pow(parameters.dy, 2)));
-
-    // Stability condition for substance difussion
-    possible_dt.push_back(
-            (parameters.nof_substances() <= 0)
-            ? DBL_MAX
-            : 1 / ( 2 * std::max_element(parameters.substance.begin(), parameters.substance.end(), [](substance_t a, substance_t b){ return a.lambda < b.lambda; })->lambda
-              * ( 1/pow(parameters.dx, 2) + 1/pow(parameters.dy, 2)) ));
+    // Stability conditions for energy transport and substance diffusion.
+    // With sub-cycling each scalar may take several steps of its own per
+    // time step, see scalar_substeps()
+    std::vector<double> scalar_dt = scalar_max_dt(parameters);
+    possible_dt.push_back(parameters.transport_subcycles * *std::min_element(scalar_dt.begin(), scalar_dt.end()));
 
-    // Stability condition for substance reaction
-    possible_dt.push_back( reaction_max_dt(C, T, Flag, parameters, rates) );
+    // Stability condition for substance reaction, the implicit integrator
+    // has none
+    if (parameters.chemistry == CHEMISTRY_EULER) {
+        possible_dt.push_back( reaction_max_dt(C, R, cells) );
+    }
 
 
     /* STEP 3
@@ -210,40 +307,28 @@ void calculate_uv(
   double dy,
   int imax,
   int jmax,
-  double **U,
-  double **V,
-  double **F,
-  double **G,
-  double **P,
-  int **Flag
+  Field2D<double> &U,
+  Field2D<double> &V,
+  Field2D<double> &F,
+  Field2D<double> &G,
+  Field2D<double> &P,
+  CellLists const &cells
 ) {
-    for (int i = 1; i < imax; ++i) {
-        for (int j = 1; j < jmax; ++j) {
-            if ( Flag[i][j] & 16 ){
-                if ( Flag[i+1][j] & 16 ){
-                    // eq 7 for  i=1..imax-1, j=1..jmax-1
-                    U[i][j] = F[i][j] - dt / dx * (P[i+1][j] - P[i][j]);
-                }
-
-                if( Flag[i][j+1] & 16 ){
-                    // eq 8 for  i=1..imax-1, j=1..jmax-1
-                    V[i][j] = G[i][j] - dt / dy * (P[i][j+1] - P[i][j]);
-                }
-            }
-        }
-    }
-
-    for (int i = 1; i < imax; ++i) {
-        if ( Flag[i][jmax] & 16 ){
-            // eq 7 for  i=1..imax-1, j=jmax
-            U[i][jmax] = F[i][jmax] - dt / dx * (P[i+1][jmax] - P[i][jmax]);
+    // eq 7 between two fluid cells, i.e. i=1..imax-1, j=1..jmax
+    #pragma omp parallel for schedule(static)
+    for (size_t r = 0; r < cells.u_faces.size(); ++r) {
+        int i = cells.u_faces[r].i;
+        for (int j = cells.u_faces[r].jlow; j <= cells.u_faces[r].jhigh; ++j) {
+            U[i][j] = F[i][j] - dt / dx * (P[i+1][j] - P[i][j]);
         }
     }
 
-    for (int j = 1; j < jmax; ++j) {
-        if ( Flag[imax][j] & 16 ){
-            // eq 8 for  i=imax, j=1..jmax-1
-            V[imax][j] = G[imax][j] - dt / dy * (P[imax][j+1] - P[imax][j]);
+    // eq 8 between two fluid cells, i.e. i=1..imax, j=1..jmax-1
+    #pragma omp parallel for schedule(static)
+    for (size_t r = 0; r < cells.v_faces.size(); ++r) {
+        int i = cells.v_faces[r].i;
+        for (int j = cells.v_faces[r].jlow; j <= cells.v_faces[r].jhigh; ++j) {
+            V[i][j] = G[i][j] - dt / dy * (P[i][j+1] - P[i][j]);
         }
     }
 }
@@ -251,7 +336,7 @@ void calculate_uv(
 
 /* The following functions compute derivatives as shown in equations 4 and 5*/
 
-double du2dx(int i, int j, double **U, double **V, double dx, double dy, double alpha){
+double du2dx(int i, int j, Field2D<double> &U, Field2D<double> &V, double dx, double dy, double alpha){
   return 1 / (dx * 4) * (
     ( ( U[i][j] + U[i+1][j] ) * ( U[i][j] + U[i+1][j] ) -
       ( U[i-1][j] + U[i][j] ) * ( U[i-1][j] + U[i][j] ) )
@@ -261,7 +346,7 @@ double du2dx(int i, int j, double **U, double **V, double dx, double dy, double
     );
 }
 
-double duvdy(int i, int j, double **U, double **V, double dx, double dy, double alpha){
+double duvdy(int i, int j, Field2D<double> &U, Field2D<double> &V, double dx, double dy, double alpha){
   return 1 / (dy * 4 ) * (
     ( ( V[i][j] + V[i+1][j] ) * ( U[i][j] + U[i][j+1] ) -
       ( V[i][j-1] + V[i+1][j-1] ) * ( U[i][j-1] + U[i][j] ) )
@@ -271,7 +356,7 @@ double duvdy(int i, int j, double **U, double **V, double dx, double dy, double
     );
 }
 
-double duvdx(int i, int j, double **U, double **V, double dx, double dy, double alpha){
+double duvdx(int i, int j, Field2D<double> &U, Field2D<double> &V, double dx, double dy, double alpha){
   return 1 / ( dx * 4 ) * (
     ( ( U[i][j] + U[i][j+1] ) * ( V[i][j] + V[i+1][j] ) -
       ( U[i-1][j] + U[i-1][j+1] ) * ( V[i-1][j] + V[i][j] ) )
@@ -281,7 +366,7 @@ double duvdx(int i, int j, double **U, double **V, double dx, double dy, double
     );
 }
 
-double dv2dy(int i, int j, double **U, double **V, double dx, double dy, double alpha){
+double dv2dy(int i, int j, Field2D<double> &U, Field2D<double> &V, double dx, double dy, double alpha){
   return 1 / ( dy * 4 ) * (
     ( ( V[i][j] + V[i][j+1] ) * ( V[i][j] + V[i][j+1] ) -
       ( V[i][j-1] + V[i][j] ) * ( V[i][j-1] + V[i][j] ) )
@@ -4,10 +4,18 @@
 #include <math.h>
 #include <algorithm>
 #include "reaction.h"
+#include "field2d.h"
+#include "cell_lists.h"
 
 // forward declaration
 class Parameters;
 
+// How F, G and the right-hand side of the pressure equation are computed
+enum rhs_kernel {
+    RHS_SPLIT = 0,          // calculate_fg(), then calculate_rs()
+    RHS_FUSED = 1           // calculate_fg_rs()
+};
+
 /**
  * Determines the value of U and G according to the formula
  *
@@ -31,12 +39,12 @@ class Parameters;
  */
 void calculate_fg(
   const Parameters & parameters,
-  double **U,
-  double **V,
-  double **T,
-  double **F,
-  double **G,
-  int **Flag,
+  Field2D<double> &U,
+  Field2D<double> &V,
+  Field2D<double> &T,
+  Field2D<double> &F,
+  Field2D<double> &G,
+  CellLists const &cells,
   double dt
 );
 
@@ -54,10 +62,31 @@ void calculate_rs(
   double dy,
   int imax,
   int jmax,
-  double **F,
-  double **G,
-  double **RS,
-  int **Flag
+  Field2D<double> &F,
+  Field2D<double> &G,
+  Field2D<double> &RS,
+  CellLists const &cells
+);
+
+
+/**
+ * calculate_fg() and calculate_rs() in one pass. Every thread takes a block
+ * of rows and computes RS of a row right after its F and G, while they are
+ * still in cache. RS of the first row of a block also needs F of the row
+ * before, which belongs to the previous block; the thread computes that
+ * row once more into a halo of its own instead of waiting for it. The
+ * results are the same as with the two separate calls.
+ */
+void calculate_fg_rs(
+  const Parameters & parameters,
+  Field2D<double> &U,
+  Field2D<double> &V,
+  Field2D<double> &T,
+  Field2D<double> &F,
+  Field2D<double> &G,
+  Field2D<double> &RS,
+  CellLists const &cells,
+  double dt
 );
 
 
@@ -68,16 +97,18 @@ void calculate_rs(
  *
  * @f$ {\delta t} := \tau \, \min\left( \frac{Re}{2}\left(\frac{1}{{\delta x}^2} + \frac{1}{{\delta y}^2}\right)^{-1},  \frac{{\delta x}}{|u_{max}|},\frac{{\delta y}}{|v_{max}|} \right) @f$
  *
+ * further limited by heat and substance diffusion and, with the explicit
+ * chemistry, by the reaction rates R from ReactionNetwork::rates().
+ *
  */
 void calculate_dt(
   const Parameters & parameters,
   double *dt,
-  double **U,
-  double **V,
-  double **T,
-  double ***C,
-  int **Flag,
-  std::vector<double> & rates
+  Field2D<double> &U,
+  Field2D<double> &V,
+  std::vector<Field2D<double> > const &C,
+  std::vector<Field2D<double> > const &R,
+  CellLists const &cells
 );
 
 
@@ -100,12 +131,12 @@ void calculate_uv(
   double dy,
   int imax,
   int jmax,
-  double **U,
-  double **V,
-  double **F,
-  double **G,
-  double **P,
-  int **Flag
+  Field2D<double> &U,
+  Field2D<double> &V,
+  Field2D<double> &F,
+  Field2D<double> &G,
+  Field2D<double> &P,
+  CellLists const &cells
 );
 
 #endif
@@ -3,30 +3,33 @@
 #include "Range2.h"
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <string.h>
+#include <stdint.h>
+#include <zlib.h>
 #include <boost/algorithm/string/replace.hpp>
 
-void write_scalars_double (std::ofstream &file, std::string name, double **m, Range2 &range)
+void write_scalars_double (std::ofstream &file, std::string name, Field2D<double> const &m, Range2 &range)
 {
-    file << "SCALARS " << name << " float 1" << std::endl;
-    file << "LOOKUP_TABLE default" << std::endl;
+    file << "SCALARS " << name << " float 1\n";
+    file << "LOOKUP_TABLE default\n";
     for(int j = range.j.low; j <= range.j.high; j++) {
         for(int i = range.i.low; i <= range.i.high; i++) {
-            file << m[i][j] << std::endl;
+            file << m[i][j] << '\n';
         }
     }
-    file << std::endl;
+    file << '\n';
 }
 
-void write_vtkHeader(std::ofstream &file, int imax, int jmax, 
-                      double dx, double dy) {
-    file << "# vtk DataFile Version 2.0" << std::endl
-         << "TUM CFDlab SS2012 Carlos, Chris, Benedikt" << std::endl
-         << "ASCII" << std::endl
-         << std::endl
-         << "DATASET STRUCTURED_GRID" << std::endl
-         << "DIMENSIONS "  << imax+1 << " " << jmax+1 << " 1" << std::endl
-         << "POINTS " << (imax+1)*(jmax+1) << " float" << std:: endl
-         << std::endl;
+void write_vtkHeader(std::ofstream &file, int imax, int jmax,
+                      double dx, double dy, char const *format) {
+    file << "# vtk DataFile Version 2.0\n"
+         << "TUM CFDlab SS2012 Carlos, Chris, Benedikt\n"
+         << format << '\n'
+         << '\n'
+         << "DATASET STRUCTURED_GRID\n"
+         << "DIMENSIONS "  << imax+1 << " " << jmax+1 << " 1\n"
+         << "POINTS " << (imax+1)*(jmax+1) << " float\n";
 }
 
 
@@ -37,61 +40,308 @@ void write_vtkPointCoordinates(std::ofstream &file, int imax, int jmax, double d
 
     for(int j = 0; j < jmax+1; j++) {
         for(int i = 0; i < imax+1; i++) {
-            file << originX+(i*dx) << " " << originY+(j*dy) << " 0" << std::endl;
+            file << originX+(i*dx) << " " << originY+(j*dy) << " 0\n";
         }
     }
-    file << std::endl;
+    file << '\n';
+}
+
+
+/*
+ * The binary formats convert all values to float first, so that every array
+ * is written from one buffer with a single call.
+ */
+
+// Cell values i=1..imax, j=1..jmax, x direction fastest
+static void cell_values (Parameters const &params, Field2D<double> const &m, std::vector<float> &out)
+{
+    out.clear();
+    out.reserve(params.imax * params.jmax);
+    for (int j = 1; j <= params.jmax; j++) {
+        for (int i = 1; i <= params.imax; i++) {
+            out.push_back(m[i][j]);
+        }
+    }
+}
+
+// Velocities interpolated to the cell corners, three components per point
+static void point_velocities (Parameters const &params, Field2D<double> const &U, Field2D<double> const &V, std::vector<float> &out)
+{
+    out.clear();
+    out.reserve(3 * (params.imax + 1) * (params.jmax + 1));
+    for (int j = 0; j <= params.jmax; j++) {
+        for (int i = 0; i <= params.imax; i++) {
+            out.push_back((U[i][j] + U[i][j+1]) * 0.5);
+            out.push_back((V[i][j] + V[i+1][j]) * 0.5);
+            out.push_back(0);
+        }
+    }
+}
+
+static void point_coordinates (Parameters const &params, std::vector<float> &out)
+{
+    out.clear();
+    out.reserve(3 * (params.imax + 1) * (params.jmax + 1));
+    for (int j = 0; j <= params.jmax; j++) {
+        for (int i = 0; i <= params.imax; i++) {
+            out.push_back(i * params.dx);
+            out.push_back(j * params.dy);
+            out.push_back(0);
+        }
+    }
+}
+
+static bool little_endian ()
+{
+    uint16_t probe = 1;
+    return *reinterpret_cast<unsigned char *>(&probe) == 1;
+}
+
+// Legacy binary files are big-endian, whatever the machine is
+static void write_big_endian (std::ofstream &file, std::vector<float> &values)
+{
+    if (little_endian()) {
+        for (size_t n = 0; n < values.size(); n++) {
+            uint32_t bits;
+            memcpy(&bits, &values[n], 4);
+            bits = (bits >> 24) | ((bits >> 8) & 0xff00) | ((bits << 8) & 0xff0000) | (bits << 24);
+            memcpy(&values[n], &bits, 4);
+        }
+    }
+    file.write(reinterpret_cast<char const *>(&values[0]), values.size() * sizeof(float));
+    file << '\n';
+}
+
+static void write_vtk_binary (std::ofstream &file, Parameters const &params,
+                              Field2D<double> const &U, Field2D<double> const &V, Field2D<double> const &P, Field2D<double> const &T,
+                              std::vector<Field2D<double> > const &C, std::vector<std::string> const &names)
+{
+    std::vector<float> buffer;
+
+    write_vtkHeader(file, params.imax, params.jmax, params.dx, params.dy, "BINARY");
+    point_coordinates(params, buffer);
+    write_big_endian(file, buffer);
+
+    file << "POINT_DATA " << (params.imax+1)*(params.jmax+1) << '\n'
+         << "VECTORS velocity float\n";
+    point_velocities(params, U, V, buffer);
+    write_big_endian(file, buffer);
+
+    file << "CELL_DATA " << params.imax * params.jmax << '\n';
+
+    Field2D<double> const *fields[2] = {&P, &T};
+    for (unsigned int k = 0; k < names.size(); ++k) {
+        file << "SCALARS " << names[k] << " float 1\n"
+             << "LOOKUP_TABLE default\n";
+        cell_values(params, k < 2 ? *fields[k] : C[k-2], buffer);
+        write_big_endian(file, buffer);
+    }
+}
+
+
+static std::string base64 (unsigned char const *data, size_t size)
+{
+    static char const table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    std::string out;
+    out.reserve((size + 2) / 3 * 4);
+    for (size_t n = 0; n < size; n += 3) {
+        uint32_t chunk = data[n] << 16;
+        if (n + 1 < size) chunk |= data[n+1] << 8;
+        if (n + 2 < size) chunk |= data[n+2];
+
+        out += table[(chunk >> 18) & 63];
+        out += table[(chunk >> 12) & 63];
+        out += (n + 1 < size) ? table[(chunk >> 6) & 63] : '=';
+        out += (n + 2 < size) ? table[chunk & 63]        : '=';
+    }
+    return out;
+}
+
+// One array of the appended section: a UInt64 header, followed by the data.
+// With compression the whole array is a single zlib block and the header is
+// [number of blocks, block size, size of a partial last block, compressed
+// size]. With base64 header and data are encoded separately, as VTK does.
+static std::string appended_block (std::vector<float> const &values, Parameters const &params)
+{
+    unsigned char const *data = reinterpret_cast<unsigned char const *>(&values[0]);
+    uint64_t size = values.size() * sizeof(float);
+
+    std::vector<uint64_t> header;
+    std::vector<unsigned char> compressed;
+    if (params.out_compression == OUTPUT_ZLIB) {
+        uLongf csize = compressBound(size);
+        compressed.resize(csize);
+        if (compress2(&compressed[0], &csize, data, size, Z_DEFAULT_COMPRESSION) != Z_OK) {
+            ERROR("zlib failed to compress output data");
+        }
+        compressed.resize(csize);
+
+        header.push_back(1);
+        header.push_back(size);
+        header.push_back(0);
+        header.push_back(csize);
+        data = &compressed[0];
+        size = csize;
+    }
+    else {
+        header.push_back(size);
+    }
+
+    unsigned char const *hdata = reinterpret_cast<unsigned char const *>(&header[0]);
+    size_t hsize = header.size() * sizeof(uint64_t);
+
+    if (params.out_encoding == OUTPUT_BASE64) {
+        return base64(hdata, hsize) + base64(data, size);
+    }
+    std::string block(reinterpret_cast<char const *>(hdata), hsize);
+    block.append(reinterpret_cast<char const *>(data), size);
+    return block;
+}
+
+static void write_vtk_xml (std::ofstream &file, Parameters const &params,
+                           Field2D<double> const &U, Field2D<double> const &V, Field2D<double> const &P, Field2D<double> const &T,
+                           std::vector<Field2D<double> > const &C, std::vector<std::string> const &names)
+{
+    bool image = (params.out_format == OUTPUT_VTI);
+    char const *type = image ? "ImageData" : "StructuredGrid";
+
+    // The offsets in the header depend on the (compressed) size of every
+    // array, so all blocks are assembled first
+    std::vector<std::string> blocks;
+    std::vector<float> buffer;
+
+    point_velocities(params, U, V, buffer);
+    blocks.push_back(appended_block(buffer, params));
+
+    Field2D<double> const *fields[2] = {&P, &T};
+    for (unsigned int k = 0; k < names.size(); ++k) {
+        cell_values(params, k < 2 ? *fields[k] : C[k-2], buffer);
+        blocks.push_back(appended_block(buffer, params));
+    }
+
+    if (!image) {
+        point_coordinates(params, buffer);
+        blocks.push_back(appended_block(buffer, params));
+    }
+
+    std::vector<size_t> offsets(1, 0);
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        offsets.push_back(offsets.back() + blocks[b].size());
+    }
+
+    std::ostringstream extent;
+    extent << "0 " << params.imax << " 0 " << params.jmax << " 0 0";
+
+    std::ostringstream xml;
+    xml << "<?xml version=\"1.0\"?>\n"
+        << "<VTKFile type=\"" << type << "\" version=\"1.0\" byte_order=\""
+        << (little_endian() ? "LittleEndian" : "BigEndian") << "\" header_type=\"UInt64\""
+        << (params.out_compression == OUTPUT_ZLIB ? " compressor=\"vtkZLibDataCompressor\"" : "") << ">\n";
+    if (image) {
+        xml << "  <ImageData WholeExtent=\"" << extent.str() << "\" Origin=\"0 0 0\" Spacing=\""
+            << params.dx << " " << params.dy << " 1\">\n";
+    }
+    else {
+        xml << "  <StructuredGrid WholeExtent=\"" << extent.str() << "\">\n";
+    }
+    xml << "    <Piece Extent=\"" << extent.str() << "\">\n"
+        << "      <PointData Vectors=\"velocity\">\n"
+        << "        <DataArray type=\"Float32\" Name=\"velocity\" NumberOfComponents=\"3\" format=\"appended\" offset=\"0\"/>\n"
+        << "      </PointData>\n"
+        << "      <CellData Scalars=\"pressure\">\n";
+    for (unsigned int k = 0; k < names.size(); ++k) {
+        xml << "        <DataArray type=\"Float32\" Name=\"" << names[k] << "\" format=\"appended\" offset=\"" << offsets[k+1] << "\"/>\n";
+    }
+    xml << "      </CellData>\n";
+    if (!image) {
+        xml << "      <Points>\n"
+            << "        <DataArray type=\"Float32\" NumberOfComponents=\"3\" format=\"appended\" offset=\"" << offsets[names.size()+1] << "\"/>\n"
+            << "      </Points>\n";
+    }
+    xml << "    </Piece>\n"
+        << "  </" << type << ">\n"
+        << "  <AppendedData encoding=\"" << (params.out_encoding == OUTPUT_BASE64 ? "base64" : "raw") << "\">\n"
+        << "   _";
+
+    std::string const &head = xml.str();
+    file.write(head.data(), head.size());
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        file.write(blocks[b].data(), blocks[b].size());
+    }
+    file << "\n  </AppendedData>\n"
+         << "</VTKFile>\n";
 }
 
 
 void write_vtkFile(std::string const &problem,
                  int    timeStepNumber,
                  Parameters const &params,
-                 double **U,
-                 double **V,
-                 double **P,
-                 double **T,
-                 double ***C) {
+                 Field2D<double> const &U,
+                 Field2D<double> const &V,
+                 Field2D<double> const &P,
+                 Field2D<double> const &T,
+                 std::vector<Field2D<double> > const &C) {
 
     int i,j;
 
-    std::string filename = problem + "." + std::to_string(timeStepNumber) + ".vtk";
+    if (params.out_format == OUTPUT_NONE) return;
+
+    static char const *suffix[] = {".vtk", ".vtk", ".vti", ".vts"};
+    std::string filename = problem + "." + std::to_string(timeStepNumber) + suffix[params.out_format];
 
-    std::ofstream file(filename);
+    std::ofstream file(filename, std::ios::binary);
     if (not file.good()) {
         ERROR(std::string("Failed to open " + filename).c_str());
         return;
     }
 
+    // Names of the cell data arrays
+    std::vector<std::string> names;
+    names.push_back("pressure");
+    names.push_back("temperature");
+    for (unsigned int s = 0; s < params.nof_substances(); ++s) {
+        std::string name = params.substance[s].name;
+        boost::algorithm::replace_all(name, " ", "_");
+        names.push_back(name);
+    }
+
+    if (params.out_format == OUTPUT_VTK_BINARY) {
+        write_vtk_binary(file, params, U, V, P, T, C, names);
+        return;
+    }
+    if (params.out_format == OUTPUT_VTI || params.out_format == OUTPUT_VTS) {
+        write_vtk_xml(file, params, U, V, P, T, C, names);
+        return;
+    }
+
     Range2 range(1, params.imax, 1, params.jmax);
 
-    write_vtkHeader(file, params.imax, params.jmax, params.dx, params.dy);
+    write_vtkHeader(file, params.imax, params.jmax, params.dx, params.dy, "ASCII");
+    file << '\n';
     write_vtkPointCoordinates(file, params.imax, params.jmax, params.dx, params.dy);
 
-    file << "POINT_DATA " << std::to_string((params.imax+1)*(params.jmax+1)) << std::endl;
-    file << std::endl;
+    file << "POINT_DATA " << std::to_string((params.imax+1)*(params.jmax+1)) << '\n';
+    file << '\n';
 
-    file << "VECTORS velocity float" << std::endl;
+    file << "VECTORS velocity float\n";
     for(j = 0; j < params.jmax+1; j++) {
         for(i = 0; i < params.imax+1; i++) {
-            file << std::to_string((U[i][j] + U[i][j+1]) * 0.5) << " " << std::to_string((V[i][j] + V[i+1][j]) * 0.5) << " 0" << std::endl;
+            file << std::to_string((U[i][j] + U[i][j+1]) * 0.5) << " " << std::to_string((V[i][j] + V[i+1][j]) * 0.5) << " 0\n";
         }
     }
-    file << std::endl;
+    file << '\n';
 
-    file << "CELL_DATA " << std::to_string(params.imax * params.jmax) << std::endl;
+    file << "CELL_DATA " << std::to_string(params.imax * params.jmax) << '\n';
 
     write_scalars_double (file, "pressure", P, range);
 
     write_scalars_double (file, "temperature", T, range);
 
     for (unsigned int s = 0; s < params.nof_substances(); ++s) {
-        std::string name = params.substance[s].name;
-        boost::algorithm::replace_all(name, " ", "_");
-        write_scalars_double (file, name, C[s], range);
+        write_scalars_double (file, names[s+2], C[s], range);
     }
 
     file.close();
 }
 
-
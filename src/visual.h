@@ -3,11 +3,39 @@
 #ifndef __VISUAL_H__
 #define __VISUAL_H__
 
+#include "field2d.h"
+#include <vector>
+
+// File format of the output, selected by <output><format>
+enum output_format {
+    OUTPUT_VTK_ASCII  = 0,  // legacy VTK, ASCII (.vtk)
+    OUTPUT_VTK_BINARY = 1,  // legacy VTK, big-endian floats (.vtk)
+    OUTPUT_VTI        = 2,  // VTK XML image data (.vti)
+    OUTPUT_VTS        = 3,  // VTK XML structured grid (.vts)
+    OUTPUT_NONE       = 4   // no files at all, e.g. for benchmarks
+};
+
+// Encoding of the appended data of the XML formats
+enum output_encoding {
+    OUTPUT_RAW    = 0,
+    OUTPUT_BASE64 = 1
+};
+
+// Compression of the arrays of the XML formats
+enum output_compression {
+    OUTPUT_UNCOMPRESSED = 0,
+    OUTPUT_ZLIB         = 1
+};
+
 /**
  * Method for writing header information in vtk format. 
  * 
  * The name of the file consists of the problem name (szProblem) 
- * and of the current time step. It gets the suffix .vtk. 
+ * and of the current time step. It gets the suffix .vtk, .vti or .vts
+ * depending on the format configured in parameters.
+ *
+ * The binary formats write every array with a single call from a float
+ * buffer. The XML formats put all arrays into one appended section.
  * 
  * @param szProblem      File pointer for writing info.  
  * @param timeStepNumber Number of the current time step to be printed.  
@@ -26,10 +54,10 @@
 void write_vtkFile(std::string const &problem,
                   int    timeStepNumber,
                   Parameters const &parameters,
-                  double **U,
-                  double **V,
-                  double **P,
-                  double **T,
-                  double ***C);
+                  Field2D<double> const &U,
+                  Field2D<double> const &V,
+                  Field2D<double> const &P,
+                  Field2D<double> const &T,
+                  std::vector<Field2D<double> > const &C);
 
 #endif